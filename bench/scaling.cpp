@@ -0,0 +1,404 @@
+/**
+ * Concurrency scaling benchmark: feeds 1..N Pipes at once and reports how throughput and latency hold up.
+ *
+ * Each pipe runs this executable again with `--sink`, which reads stdin and discards it,
+ * so the numbers measure the library and the OS pipes rather than an encoder.
+ */
+
+#include <ffmpipe/ffmpipe.h>
+#include <winternl.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <unordered_set>
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions
+{
+    uint32_t max_pipes = 16;
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    uint32_t bytes_per_pixel = 3;
+    /// @brief Frames per second written to each pipe, or 0 to write as fast as possible.
+    double fps = 60;
+    double seconds = 5;
+    bool linear = false;
+    const char* csv_path = nullptr;
+    const char* json_path = nullptr;
+};
+
+/// @brief One point of the scaling curve
+struct RunResult
+{
+    uint32_t pipes = 0;
+    uint32_t failed_pipes = 0;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    double throughput_mbps = 0;
+    double fps_per_pipe = 0;
+    /// @brief Write call durations in microseconds, pooled over all pipes.
+    double write_p50_us = 0;
+    double write_p95_us = 0;
+    double write_p99_us = 0;
+    double write_max_us = 0;
+    /// @brief The highest 99th percentile of any single pipe.
+    double worst_pipe_p99_us = 0;
+    /// @brief CPU time of this process and all sinks.
+    double cpu_seconds = 0;
+    double cpu_seconds_per_gb = 0;
+    uint64_t context_switches = 0;
+    double context_switches_per_frame = 0;
+};
+
+static int RunSink();
+static bool ParseArgs(int argc, char** argv, BenchOptions& options);
+static RunResult Run(const BenchOptions& options, uint32_t pipe_count);
+static void WriteCsv(FILE* file, const std::vector<RunResult>& results);
+static void WriteJson(FILE* file, const BenchOptions& options, const std::vector<RunResult>& results);
+
+int main(int argc, char** argv)
+{
+    if (argc == 2 && strcmp(argv[1], "--sink") == 0)
+        return RunSink();
+
+    BenchOptions options;
+    if (!ParseArgs(argc, argv, options))
+    {
+        printf(
+            "ffmpipe_scaling [--pipes N] [--size WxH] [--bpp N] [--fps F] [--seconds S] [--linear]\n"
+            "                [--csv <path>] [--json <path>]\n"
+            "Runs 1, 2, 4, .. N concurrent pipes (every count with --linear) into a discarding sink.\n"
+            "--fps 0 writes as fast as possible. Prints CSV to stdout unless --csv or --json is given.\n"
+        );
+        return 1;
+    }
+
+    std::vector<uint32_t> counts;
+    for (uint32_t n = 1; n < options.max_pipes; n = options.linear ? n + 1 : n * 2)
+        counts.push_back(n);
+    counts.push_back(options.max_pipes);
+
+    std::vector<RunResult> results;
+    for (uint32_t n : counts)
+    {
+        RunResult result = Run(options, n);
+        fprintf(stderr, "%3u pipes: %9.1f MB/s, write p99 %8.0f us, %6.2f cpu-s/GB, %6.2f switches/frame\n",
+            result.pipes, result.throughput_mbps, result.write_p99_us,
+            result.cpu_seconds_per_gb, result.context_switches_per_frame
+        );
+        results.push_back(result);
+    }
+
+    if (options.csv_path)
+    {
+        FILE* file = fopen(options.csv_path, "w");
+        if (!file)
+            return 1;
+        WriteCsv(file, results);
+        fclose(file);
+    }
+    if (options.json_path)
+    {
+        FILE* file = fopen(options.json_path, "w");
+        if (!file)
+            return 1;
+        WriteJson(file, options, results);
+        fclose(file);
+    }
+    if (!options.csv_path && !options.json_path)
+        WriteCsv(stdout, results);
+    return 0;
+}
+
+int RunSink()
+{
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    std::vector<char> buffer(1024 * 1024);
+    DWORD read = 0;
+    while (ReadFile(input, buffer.data(), (DWORD)buffer.size(), &read, nullptr) && read > 0)
+        ;
+    return 0;
+}
+
+bool ParseArgs(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--linear")
+        {
+            options.linear = true;
+            continue;
+        }
+        if (!value)
+            return false;
+        ++i;
+
+        if (arg == "--pipes")
+            options.max_pipes = (uint32_t)atoi(value);
+        else if (arg == "--size")
+        {
+            if (sscanf(value, "%ux%u", &options.width, &options.height) != 2)
+                return false;
+        }
+        else if (arg == "--bpp")
+            options.bytes_per_pixel = (uint32_t)atoi(value);
+        else if (arg == "--fps")
+            options.fps = atof(value);
+        else if (arg == "--seconds")
+            options.seconds = atof(value);
+        else if (arg == "--csv")
+            options.csv_path = value;
+        else if (arg == "--json")
+            options.json_path = value;
+        else
+            return false;
+    }
+    return options.max_pipes > 0 && options.width > 0 && options.height > 0
+        && options.bytes_per_pixel > 0 && options.fps >= 0 && options.seconds > 0;
+}
+
+/// @brief Sum the context switches of all threads in the given processes
+static uint64_t CountContextSwitches(const std::unordered_set<DWORD>& process_ids)
+{
+    std::vector<uint8_t> buffer(1024 * 1024);
+    ULONG needed = 0;
+    NTSTATUS status;
+    while ((status = NtQuerySystemInformation(SystemProcessInformation, buffer.data(), (ULONG)buffer.size(), &needed))
+        == (NTSTATUS)0xC0000004L) // STATUS_INFO_LENGTH_MISMATCH
+    {
+        buffer.resize(needed + 64 * 1024);
+    }
+    if (status < 0)
+        return 0;
+
+    uint64_t switches = 0;
+    size_t offset = 0;
+    for (;;)
+    {
+        auto* process = (SYSTEM_PROCESS_INFORMATION*)(buffer.data() + offset);
+        if (process_ids.count((DWORD)(ULONG_PTR)process->UniqueProcessId))
+        {
+            // The thread array follows the process entry. Reserved3 is the context switch count.
+            auto* threads = (SYSTEM_THREAD_INFORMATION*)(process + 1);
+            for (ULONG i = 0; i < process->NumberOfThreads; ++i)
+                switches += threads[i].Reserved3;
+        }
+        if (process->NextEntryOffset == 0)
+            break;
+        offset += process->NextEntryOffset;
+    }
+    return switches;
+}
+
+static double ProcessCpuSeconds(HANDLE process)
+{
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(process, &creation_time, &exit_time, &kernel_time, &user_time))
+        return 0;
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernel_time.dwLowDateTime;
+    kernel.HighPart = kernel_time.dwHighDateTime;
+    user.LowPart = user_time.dwLowDateTime;
+    user.HighPart = user_time.dwHighDateTime;
+    return (kernel.QuadPart + user.QuadPart) / 1e7; // 100-nanosecond units
+}
+
+/// @brief The value below which `fraction` of the sorted samples fall
+static double Percentile(const std::vector<uint32_t>& sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+RunResult Run(const BenchOptions& options, uint32_t pipe_count)
+{
+    RunResult result;
+    result.pipes = pipe_count;
+
+    const size_t frame_size = (size_t)options.width * options.height * options.bytes_per_pixel;
+    std::vector<uint8_t> frame(frame_size);
+    for (size_t i = 0; i < frame_size; ++i)
+        frame[i] = (uint8_t)(i * 31);
+
+    wchar_t self_path[MAX_PATH];
+    GetModuleFileNameW(nullptr, self_path, MAX_PATH);
+
+    // Spawn every sink before timing starts, so the curve shows steady-state cost only
+    std::vector<ffmpipe::PipePtr> pipes;
+    std::unordered_set<DWORD> process_ids = { GetCurrentProcessId() };
+    for (uint32_t i = 0; i < pipe_count; ++i)
+    {
+        ffmpipe::PipeOptions pipe_options;
+        pipe_options.stdin_buffer_size = (DWORD)std::clamp<size_t>(frame_size * 2, 64 * 1024, 64 * 1024 * 1024);
+        pipe_options.stdout_buffer_size = 4096;
+        ffmpipe::PipePtr pipe = ffmpipe::Pipe::Create(self_path, L"--sink", pipe_options);
+        if (!pipe)
+        {
+            ++result.failed_pipes;
+            continue;
+        }
+        pipe->SetPrintFunc(nullptr);
+        process_ids.insert(pipe->GetProcessId());
+        pipes.push_back(pipe);
+    }
+
+    const double self_cpu_start = ProcessCpuSeconds(GetCurrentProcess());
+    const uint64_t switches_start = CountContextSwitches(process_ids);
+
+    std::vector<std::vector<uint32_t>> write_us(pipes.size());
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> frames = 0;
+    std::atomic<uint32_t> failed = 0;
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    const Clock::duration interval = options.fps > 0
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.fps))
+        : Clock::duration::zero();
+
+    // Only live threads are counted, so writers wait here until the end count is taken
+    std::mutex barrier_mutex;
+    std::condition_variable barrier;
+    size_t writers_done = 0;
+    bool counted = false;
+
+    for (size_t i = 0; i < pipes.size(); ++i)
+    {
+        threads.emplace_back([&, i] {
+            std::vector<uint32_t>& samples = write_us[i];
+            samples.reserve(options.fps > 0 ? (size_t)(options.fps * options.seconds) + 1 : 4096);
+            Clock::time_point deadline = start;
+            for (;;)
+            {
+                Clock::time_point now = Clock::now();
+                if (now >= end)
+                    break;
+                if (now < deadline)
+                {
+                    std::this_thread::sleep_until(deadline);
+                    now = Clock::now();
+                }
+                deadline += interval;
+
+                if (!pipes[i]->Write(frame.data(), frame.size()))
+                {
+                    ++failed;
+                    break;
+                }
+                samples.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - now).count());
+                ++frames;
+            }
+
+            std::unique_lock<std::mutex> lock(barrier_mutex);
+            ++writers_done;
+            barrier.notify_all();
+            barrier.wait(lock, [&] { return counted; });
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(barrier_mutex);
+        barrier.wait(lock, [&] { return writers_done == threads.size(); });
+    }
+
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    // Sinks exit once stdin closes, and writers once released, so count their switches first
+    result.context_switches = CountContextSwitches(process_ids) - switches_start;
+    {
+        std::lock_guard<std::mutex> lock(barrier_mutex);
+        counted = true;
+    }
+    barrier.notify_all();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    double sink_cpu = 0;
+    for (ffmpipe::PipePtr& pipe : pipes)
+    {
+        pipe->Close(10'000);
+        sink_cpu += pipe->GetProcessUsage().cpu_seconds;
+    }
+    result.cpu_seconds = ProcessCpuSeconds(GetCurrentProcess()) - self_cpu_start + sink_cpu;
+
+    result.failed_pipes += failed;
+    result.frames = frames;
+    result.bytes = result.frames * frame_size;
+    result.throughput_mbps = result.bytes / result.seconds / 1e6;
+    result.fps_per_pipe = pipes.empty() ? 0 : result.frames / result.seconds / pipes.size();
+    if (result.bytes)
+        result.cpu_seconds_per_gb = result.cpu_seconds / (result.bytes / 1e9);
+    if (result.frames)
+        result.context_switches_per_frame = (double)result.context_switches / result.frames;
+
+    std::vector<uint32_t> all;
+    for (std::vector<uint32_t>& samples : write_us)
+    {
+        std::sort(samples.begin(), samples.end());
+        double p99 = Percentile(samples, 0.99);
+        if (p99 > result.worst_pipe_p99_us)
+            result.worst_pipe_p99_us = p99;
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    std::sort(all.begin(), all.end());
+    result.write_p50_us = Percentile(all, 0.50);
+    result.write_p95_us = Percentile(all, 0.95);
+    result.write_p99_us = Percentile(all, 0.99);
+    result.write_max_us = all.empty() ? 0 : all.back();
+    return result;
+}
+
+void WriteCsv(FILE* file, const std::vector<RunResult>& results)
+{
+    fprintf(file,
+        "pipes,failed_pipes,frames,bytes,seconds,throughput_mbps,fps_per_pipe,"
+        "write_p50_us,write_p95_us,write_p99_us,write_max_us,worst_pipe_p99_us,"
+        "cpu_seconds,cpu_seconds_per_gb,context_switches,context_switches_per_frame\n"
+    );
+    for (const RunResult& r : results)
+    {
+        fprintf(file, "%u,%u,%llu,%llu,%.3f,%.2f,%.2f,%.0f,%.0f,%.0f,%.0f,%.0f,%.3f,%.3f,%llu,%.3f\n",
+            r.pipes, r.failed_pipes, (unsigned long long)r.frames, (unsigned long long)r.bytes, r.seconds,
+            r.throughput_mbps, r.fps_per_pipe,
+            r.write_p50_us, r.write_p95_us, r.write_p99_us, r.write_max_us, r.worst_pipe_p99_us,
+            r.cpu_seconds, r.cpu_seconds_per_gb, (unsigned long long)r.context_switches, r.context_switches_per_frame
+        );
+    }
+}
+
+void WriteJson(FILE* file, const BenchOptions& options, const std::vector<RunResult>& results)
+{
+    fprintf(file, "{\n  \"width\": %u, \"height\": %u, \"bytes_per_pixel\": %u, \"fps\": %g, \"seconds\": %g,\n",
+        options.width, options.height, options.bytes_per_pixel, options.fps, options.seconds
+    );
+    fprintf(file, "  \"runs\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const RunResult& r = results[i];
+        fprintf(file,
+            "    {\"pipes\": %u, \"failed_pipes\": %u, \"frames\": %llu, \"bytes\": %llu, \"seconds\": %.3f, "
+            "\"throughput_mbps\": %.2f, \"fps_per_pipe\": %.2f, "
+            "\"write_us\": {\"p50\": %.0f, \"p95\": %.0f, \"p99\": %.0f, \"max\": %.0f, \"worst_pipe_p99\": %.0f}, "
+            "\"cpu_seconds\": %.3f, \"cpu_seconds_per_gb\": %.3f, "
+            "\"context_switches\": %llu, \"context_switches_per_frame\": %.3f}%s\n",
+            r.pipes, r.failed_pipes, (unsigned long long)r.frames, (unsigned long long)r.bytes, r.seconds,
+            r.throughput_mbps, r.fps_per_pipe,
+            r.write_p50_us, r.write_p95_us, r.write_p99_us, r.write_max_us, r.worst_pipe_p99_us,
+            r.cpu_seconds, r.cpu_seconds_per_gb, (unsigned long long)r.context_switches, r.context_switches_per_frame,
+            i + 1 < results.size() ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
\ No newline at end of file
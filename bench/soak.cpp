@@ -0,0 +1,321 @@
+/**
+ * Soak benchmark: runs many Create/Write/Close cycles and checks that nothing builds up over time.
+ *
+ * Each cycle runs this executable again with `--sink`, which reads stdin and discards it.
+ * Every few cycles the pipe is dropped without Close, so the destructor's cleanup is exercised too.
+ * Samples track this process's handles, its live child processes, its private and resident memory,
+ * and the cycle latency. Exited children whose handles leak show up in the handle count,
+ * since Windows keeps a process object only while a handle to it is open.
+ *
+ * After the run, the first and last quarter of the samples are compared, skipping a warmup.
+ * The exit code is 1 if a resource grew or cycles slowed down.
+ */
+
+#include <ffmpipe/ffmpipe.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions
+{
+    uint64_t cycles = 1'000'000;
+    /// @brief Cycles between samples.
+    uint64_t sample_every = 1000;
+    uint32_t frames = 4;
+    size_t frame_bytes = 64 * 1024;
+    /// @brief Drop every Nth pipe without calling Close, or 0 to always Close.
+    uint64_t drop_every = 4;
+    /// @brief Allowed growth between the first and last quarter.
+    double max_handle_growth = 16;
+    double max_private_growth_mb = 8;
+    /// @details Looser than private memory, since the working set also counts shared pages and moves with trimming.
+    double max_resident_growth_mb = 16;
+    double max_latency_ratio = 1.5;
+    const char* csv_path = nullptr;
+};
+
+/// @brief Resources and latency after a block of cycles
+struct Sample
+{
+    uint64_t cycle = 0;
+    double seconds = 0;
+    uint32_t handles = 0;
+    uint32_t children = 0;
+    size_t private_bytes = 0;
+    size_t resident_bytes = 0;
+    uint32_t failed_cycles = 0;
+    /// @brief Cycle durations over the block, in microseconds.
+    double cycle_p50_us = 0;
+    double cycle_p99_us = 0;
+};
+
+static int RunSink();
+static bool ParseArgs(int argc, char** argv, BenchOptions& options);
+static bool CheckTrends(const BenchOptions& options, const std::vector<Sample>& samples);
+static void WriteCsv(FILE* file, const std::vector<Sample>& samples);
+
+static uint32_t CountChildren()
+{
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot == INVALID_HANDLE_VALUE)
+        return 0;
+
+    const DWORD self = GetCurrentProcessId();
+    uint32_t children = 0;
+    PROCESSENTRY32W entry;
+    entry.dwSize = sizeof(entry);
+    for (BOOL ok = Process32FirstW(snapshot, &entry); ok; ok = Process32NextW(snapshot, &entry))
+        children += entry.th32ParentProcessID == self;
+    CloseHandle(snapshot);
+    return children;
+}
+
+/// @brief The value below which `fraction` of the sorted samples fall
+static double Percentile(const std::vector<uint32_t>& sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 2 && strcmp(argv[1], "--sink") == 0)
+        return RunSink();
+
+    BenchOptions options;
+    if (!ParseArgs(argc, argv, options))
+    {
+        printf(
+            "ffmpipe_soak [--cycles N] [--sample-every N] [--frames N] [--frame-kb N] [--drop-every N]\n"
+            "             [--max-handle-growth N] [--max-private-growth-mb N] [--max-resident-growth-mb N]\n"
+            "             [--max-latency-ratio R] [--csv <path>]\n"
+            "Runs Create/Write/Close cycles into a discarding sink, sampling resources every N cycles.\n"
+            "Fails if handles, child processes, memory or cycle latency trend upward. Prints CSV to stdout unless --csv is given.\n"
+        );
+        return 1;
+    }
+
+    wchar_t self_path[MAX_PATH];
+    GetModuleFileNameW(nullptr, self_path, MAX_PATH);
+    const ffmpipe::PipeOptions pipe_options = ffmpipe::PipeOptions::Compact(options.frame_bytes);
+    std::vector<uint8_t> frame(options.frame_bytes);
+    for (size_t i = 0; i < frame.size(); ++i)
+        frame[i] = (uint8_t)(i * 31);
+
+    std::vector<Sample> samples;
+    std::vector<uint32_t> cycle_us;
+    cycle_us.reserve(options.sample_every);
+    uint32_t failed_cycles = 0;
+    const Clock::time_point start = Clock::now();
+
+    for (uint64_t cycle = 1; cycle <= options.cycles; ++cycle)
+    {
+        const Clock::time_point cycle_start = Clock::now();
+        {
+            ffmpipe::PipePtr pipe = ffmpipe::Pipe::Create(self_path, L"--sink", pipe_options);
+            if (pipe)
+            {
+                pipe->SetPrintFunc(nullptr);
+                bool ok = true;
+                for (uint32_t i = 0; i < options.frames && ok; ++i)
+                    ok = pipe->Write(frame.data(), frame.size());
+                if (!options.drop_every || cycle % options.drop_every != 0)
+                {
+                    pipe->Close(pipe_options.timeout_ms);
+                    ok = ok && pipe->GetExitCode() == 0;
+                }
+                failed_cycles += !ok;
+            }
+            else
+                ++failed_cycles;
+        }
+        cycle_us.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - cycle_start).count());
+
+        if (cycle % options.sample_every != 0 && cycle != options.cycles)
+            continue;
+
+        Sample sample;
+        sample.cycle = cycle;
+        sample.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        DWORD handles = 0;
+        GetProcessHandleCount(GetCurrentProcess(), &handles);
+        sample.handles = handles;
+        sample.children = CountChildren();
+        PROCESS_MEMORY_COUNTERS_EX memory = {0};
+        memory.cb = sizeof(memory);
+        if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&memory, sizeof(memory)))
+        {
+            sample.private_bytes = memory.PrivateUsage;
+            sample.resident_bytes = memory.WorkingSetSize;
+        }
+        sample.failed_cycles = failed_cycles;
+        std::sort(cycle_us.begin(), cycle_us.end());
+        sample.cycle_p50_us = Percentile(cycle_us, 0.50);
+        sample.cycle_p99_us = Percentile(cycle_us, 0.99);
+        cycle_us.clear();
+        samples.push_back(sample);
+
+        fprintf(stderr, "%10llu cycles: %5u handles, %2u children, %8.1f MB private, cycle p50 %6.0f us, p99 %6.0f us, %u failed\n",
+            (unsigned long long)cycle, sample.handles, sample.children, sample.private_bytes / 1048576.0,
+            sample.cycle_p50_us, sample.cycle_p99_us, sample.failed_cycles
+        );
+    }
+
+    if (options.csv_path)
+    {
+        FILE* file = fopen(options.csv_path, "w");
+        if (!file)
+            return 1;
+        WriteCsv(file, samples);
+        fclose(file);
+    }
+    else
+        WriteCsv(stdout, samples);
+
+    bool ok = CheckTrends(options, samples);
+    if (failed_cycles)
+    {
+        fprintf(stderr, "FAIL: %u cycles failed\n", failed_cycles);
+        ok = false;
+    }
+    fprintf(stderr, ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
+
+int RunSink()
+{
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    std::vector<char> buffer(1024 * 1024);
+    DWORD read = 0;
+    while (ReadFile(input, buffer.data(), (DWORD)buffer.size(), &read, nullptr) && read > 0)
+        ;
+    return 0;
+}
+
+bool ParseArgs(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string_view arg = argv[i];
+        const char* value = argv[i + 1];
+        if (arg == "--cycles")
+            options.cycles = strtoull(value, nullptr, 10);
+        else if (arg == "--sample-every")
+            options.sample_every = strtoull(value, nullptr, 10);
+        else if (arg == "--frames")
+            options.frames = (uint32_t)atoi(value);
+        else if (arg == "--frame-kb")
+            options.frame_bytes = (size_t)(atof(value) * 1024);
+        else if (arg == "--drop-every")
+            options.drop_every = strtoull(value, nullptr, 10);
+        else if (arg == "--max-handle-growth")
+            options.max_handle_growth = atof(value);
+        else if (arg == "--max-private-growth-mb")
+            options.max_private_growth_mb = atof(value);
+        else if (arg == "--max-resident-growth-mb")
+            options.max_resident_growth_mb = atof(value);
+        else if (arg == "--max-latency-ratio")
+            options.max_latency_ratio = atof(value);
+        else if (arg == "--csv")
+            options.csv_path = value;
+        else
+            return false;
+    }
+    return argc % 2 == 1 && options.cycles > 0 && options.sample_every > 0 && options.frame_bytes > 0
+        && options.max_latency_ratio > 1;
+}
+
+/// @brief Average of a field over samples [begin, end)
+template<typename Field>
+static double Average(const std::vector<Sample>& samples, size_t begin, size_t end, Field field)
+{
+    double sum = 0;
+    for (size_t i = begin; i < end; ++i)
+        sum += (double)field(samples[i]);
+    return end > begin ? sum / (end - begin) : 0;
+}
+
+bool CheckTrends(const BenchOptions& options, const std::vector<Sample>& samples)
+{
+    // Children are closed or dropped within each cycle, so any left running between cycles leaked
+    bool ok = true;
+    for (const Sample& sample : samples)
+    {
+        if (sample.children > 0)
+        {
+            fprintf(stderr, "FAIL: %u child processes still running after %llu cycles\n",
+                sample.children, (unsigned long long)sample.cycle
+            );
+            ok = false;
+            break;
+        }
+    }
+
+    // Allocators and caches settle during the first samples, so they are skipped
+    const size_t warmup = samples.size() / 10 > 0 ? samples.size() / 10 : 1;
+    if (samples.size() < warmup + 8)
+    {
+        fprintf(stderr, "too few samples to judge trends; run more cycles or sample more often\n");
+        return ok;
+    }
+    const size_t quarter = (samples.size() - warmup) / 4;
+    const size_t first_begin = warmup, first_end = warmup + quarter;
+    const size_t last_begin = samples.size() - quarter, last_end = samples.size();
+
+    const double first_handles = Average(samples, first_begin, first_end, [](const Sample& s) { return s.handles; });
+    const double last_handles = Average(samples, last_begin, last_end, [](const Sample& s) { return s.handles; });
+    if (last_handles - first_handles > options.max_handle_growth)
+    {
+        fprintf(stderr, "FAIL: handles grew from %.0f to %.0f\n", first_handles, last_handles);
+        ok = false;
+    }
+
+    const double first_private = Average(samples, first_begin, first_end, [](const Sample& s) { return s.private_bytes; });
+    const double last_private = Average(samples, last_begin, last_end, [](const Sample& s) { return s.private_bytes; });
+    if ((last_private - first_private) / 1048576.0 > options.max_private_growth_mb)
+    {
+        fprintf(stderr, "FAIL: private memory grew from %.1f MB to %.1f MB\n", first_private / 1048576.0, last_private / 1048576.0);
+        ok = false;
+    }
+
+    const double first_resident = Average(samples, first_begin, first_end, [](const Sample& s) { return s.resident_bytes; });
+    const double last_resident = Average(samples, last_begin, last_end, [](const Sample& s) { return s.resident_bytes; });
+    if ((last_resident - first_resident) / 1048576.0 > options.max_resident_growth_mb)
+    {
+        fprintf(stderr, "FAIL: working set grew from %.1f MB to %.1f MB\n", first_resident / 1048576.0, last_resident / 1048576.0);
+        ok = false;
+    }
+
+    // Compare medians, so a few slow cycles from other load on the machine don't count
+    const double first_p50 = Average(samples, first_begin, first_end, [](const Sample& s) { return s.cycle_p50_us; });
+    const double last_p50 = Average(samples, last_begin, last_end, [](const Sample& s) { return s.cycle_p50_us; });
+    if (first_p50 > 0 && last_p50 / first_p50 > options.max_latency_ratio)
+    {
+        fprintf(stderr, "FAIL: median cycle latency grew from %.0f us to %.0f us\n", first_p50, last_p50);
+        ok = false;
+    }
+    return ok;
+}
+
+void WriteCsv(FILE* file, const std::vector<Sample>& samples)
+{
+    fprintf(file, "cycle,seconds,handles,children,private_bytes,resident_bytes,failed_cycles,cycle_p50_us,cycle_p99_us\n");
+    for (const Sample& s : samples)
+    {
+        fprintf(file, "%llu,%.3f,%u,%u,%llu,%llu,%u,%.0f,%.0f\n",
+            (unsigned long long)s.cycle, s.seconds, s.handles, s.children,
+            (unsigned long long)s.private_bytes, (unsigned long long)s.resident_bytes, s.failed_cycles,
+            s.cycle_p50_us, s.cycle_p99_us
+        );
+    }
+}
\ No newline at end of file
@@ -0,0 +1,160 @@
+/**
+ * Cache pollution benchmark: how much frame copies slow down a cache-sensitive thread running beside them.
+ *
+ * A co-runner chases pointers through a working set sized to fit in the last-level cache,
+ * standing in for a renderer. Meanwhile the main thread copies frames with memcpy, then with StreamCopy.
+ * The co-runner's time per access shows how much of its working set each copy evicted.
+ */
+
+#include <ffmpipe/frame.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <numeric>
+#include <algorithm>
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions
+{
+    size_t frame_bytes = 3840 * 2160 * 3;
+    size_t working_set_bytes = 8 * 1024 * 1024;
+    double seconds = 3;
+};
+
+/// @brief Result of running the co-runner beside one kind of copy
+struct RunResult
+{
+    const char* name = "";
+    double copy_gbps = 0;
+    double access_ns = 0;
+};
+
+enum class CopyMode
+{
+    None,
+    Memcpy,
+    Stream,
+};
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string_view arg = argv[i];
+        const char* value = argv[i + 1];
+        if (arg == "--frame-mb")
+            options.frame_bytes = (size_t)(atof(value) * 1024 * 1024);
+        else if (arg == "--working-set-mb")
+            options.working_set_bytes = (size_t)(atof(value) * 1024 * 1024);
+        else if (arg == "--seconds")
+            options.seconds = atof(value);
+        else
+            return false;
+    }
+    return argc % 2 == 1 && options.frame_bytes > 0 && options.working_set_bytes >= 64 * 64 && options.seconds > 0;
+}
+
+/// @brief A random cycle through the working set, one node per cache line
+static std::vector<uint32_t> BuildChain(size_t bytes)
+{
+    const size_t LINE = 64 / sizeof(uint32_t);
+    const size_t nodes = bytes / 64;
+    std::vector<uint32_t> order(nodes);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(1234));
+
+    std::vector<uint32_t> chain(nodes * LINE);
+    for (size_t i = 0; i < nodes; ++i)
+        chain[order[i] * LINE] = (uint32_t)(order[(i + 1) % nodes] * LINE);
+    return chain;
+}
+
+static RunResult Run(const BenchOptions& options, CopyMode mode, const char* name)
+{
+    std::vector<uint32_t> chain = BuildChain(options.working_set_bytes);
+    std::vector<uint8_t> src(options.frame_bytes, 1), dst(options.frame_bytes);
+
+    std::atomic<bool> stop = false;
+    uint64_t accesses = 0;
+    double access_seconds = 0;
+    std::thread co_runner([&] {
+        // Warm the working set into the cache first
+        uint32_t node = 0;
+        for (size_t i = 0; i < chain.size() / 16; ++i)
+            node = chain[node];
+
+        const Clock::time_point start = Clock::now();
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            for (int i = 0; i < 4096; ++i)
+                node = chain[node];
+            accesses += 4096;
+        }
+        access_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (node == UINT32_MAX)
+            printf("unreachable\n");
+    });
+
+    uint64_t copied = 0;
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    while (Clock::now() < end)
+    {
+        if (mode == CopyMode::Memcpy)
+            memcpy(dst.data(), src.data(), dst.size());
+        else if (mode == CopyMode::Stream)
+            ffmpipe::StreamCopy(dst.data(), src.data(), dst.size());
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        copied += dst.size();
+    }
+    const double copy_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    stop = true;
+    co_runner.join();
+
+    RunResult result;
+    result.name = name;
+    result.copy_gbps = copied / copy_seconds / 1e9;
+    result.access_ns = accesses ? access_seconds * 1e9 / accesses : 0;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!ParseArgs(argc, argv, options))
+    {
+        printf(
+            "ffmpipe_stream_copy [--frame-mb N] [--working-set-mb N] [--seconds S]\n"
+            "Measures a pointer-chasing co-runner while frames are copied with memcpy and with StreamCopy.\n"
+            "Choose a working set that fits in the last-level cache.\n"
+        );
+        return 1;
+    }
+
+    RunResult results[] = {
+        Run(options, CopyMode::None, "idle"),
+        Run(options, CopyMode::Memcpy, "memcpy"),
+        Run(options, CopyMode::Stream, "StreamCopy"),
+    };
+
+    printf("frame %.1f MB, working set %.1f MB\n", options.frame_bytes / 1048576.0, options.working_set_bytes / 1048576.0);
+    printf("%-12s %10s %14s %10s\n", "copy", "copy GB/s", "co-runner ns", "slowdown");
+    for (const RunResult& result : results)
+    {
+        printf("%-12s %10.2f %14.2f %9.2fx\n",
+            result.name, result.copy_gbps, result.access_ns, result.access_ns / results[0].access_ns
+        );
+    }
+    return 0;
+}
\ No newline at end of file
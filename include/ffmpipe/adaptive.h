@@ -0,0 +1,173 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <ffmpipe/frame.h>
+#include <ffmpipe/profiler.h>
+#include <vector>
+#include <thread>
+
+namespace ffmpipe
+{
+
+/// @brief Parameters for AdaptiveEncoder
+struct AdaptiveOptions
+{
+    /// @brief Path of the FFmpeg executable.
+    std::filesystem::path ffmpeg_path;
+    /// @brief A packed format. Frames keep it when downscaled.
+    PixelFormat format = PixelFormat::RGB24;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    double framerate = 60;
+    /**
+     * @brief Produce the output arguments for each FFmpeg process, including the output.
+     * @details Example: `-c:v libx264 -preset veryfast part-3.mp4`. Each process is a new stream that starts
+     * with a keyframe, so name outputs by `index`, or use a live output that accepts a new stream.
+     * @param index Index of the process, starting at 0.
+     * @param width Width of the frames the process receives.
+     * @param height Height of the frames the process receives.
+     */
+    std::function<std::wstring(uint64_t index, uint32_t width, uint32_t height)> output_args;
+    /// @brief The largest downscale factor. Levels are powers of 2 up to this.
+    uint32_t max_factor = 4;
+    /// @brief Length of each measurement window in milliseconds.
+    DWORD window_ms = 1000;
+    /// @brief Share of a window spent waiting in Write that counts as backpressure.
+    double degrade_wait_share = 0.5;
+    /// @brief Consecutive windows of backpressure before halving the resolution.
+    uint32_t degrade_windows = 3;
+    /// @brief Share of a window spent waiting in Write that counts as headroom.
+    double restore_wait_share = 0.1;
+    /// @brief Consecutive windows of headroom before doubling the resolution.
+    /// @details Doubled after each restore that has to be undone, up to 8 times, so an encoder at its limit doesn't flap.
+    uint32_t restore_windows = 10;
+    /**
+     * @brief How long a new process must keep running after reading its first frame, in milliseconds.
+     * @details Write blocks for this long at each switch. A process that exits meanwhile, such as one whose encoder
+     * rejects the new size, is discarded and encoding continues at the current resolution.
+     */
+    DWORD confirm_ms = 100;
+    PipeOptions pipe_options;
+};
+
+/// @brief A change of resolution made by AdaptiveEncoder
+struct ResolutionSwitch
+{
+    /// @brief Index of the first frame at the new resolution.
+    uint64_t frame = 0;
+    /// @brief Seconds since the encoder was created.
+    double time_s = 0;
+    uint32_t from_factor = 1;
+    uint32_t to_factor = 1;
+    uint32_t from_width = 0;
+    uint32_t from_height = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    /// @brief Seconds spent at the previous resolution.
+    double previous_duration_s = 0;
+    /// @brief Time to start the new FFmpeg process and confirm it, in milliseconds.
+    double switch_ms = 0;
+    /// @brief The stall breakdown of the window that triggered the switch.
+    std::string reason;
+
+    /// @brief A one-line description, such as `frame 1800 (30.0s): 1920x1080 -> 960x540 after 30.0s, switch took 41 ms (...)`
+    std::string ToString() const;
+};
+
+/**
+ * @brief Encode realtime frames, lowering the resolution while FFmpeg can't keep up.
+ *
+ * Each Write samples a StallProfiler. When Write spends most of several consecutive windows waiting on FFmpeg,
+ * frames are downscaled by half with Downscale and a new FFmpeg process is started for the smaller size.
+ * Downscaled sizes are rounded down to even dimensions, which 4:2:0 encoders require.
+ * The switch happens on the next Write, whose frame is the new process's first. Once the process has read it
+ * and kept running for AdaptiveOptions::confirm_ms, the previous process finishes its queued frames on a background thread.
+ * Once waits stay short for a longer run of windows, the resolution is doubled again the same way.
+ * If the new process fails to start, encoding continues at the current resolution.
+ *
+ * The producer should be paced, such as a capture at the frame rate. An unpaced producer always waits on FFmpeg.
+ *
+ * Operations are not thread-safe.
+ */
+class AdaptiveEncoder
+{
+public:
+    using SwitchFunc = std::function<void(const ResolutionSwitch&)>;
+
+    ~AdaptiveEncoder();
+    AdaptiveEncoder(const AdaptiveEncoder&) = delete;
+
+    /// @brief Start FFmpeg at full resolution.
+    /// @return `nullptr` on failure.
+    static std::shared_ptr<AdaptiveEncoder> Create(AdaptiveOptions options);
+
+    /// @brief Write a full-resolution frame. Blocking.
+    /// @return `false` on failure.
+    bool Write(const void* frame);
+    /// @brief Close FFmpeg and wait for all processes to exit. Blocking.
+    void Close();
+
+    /// @brief Set the callback for printing FFmpeg's stdout.
+    void SetPrintFunc(Pipe::PrintFunc fn);
+    /// @brief Set the callback for each switch. By default, switches are printed with Pipe::DefaultPrintFunc.
+    void SetSwitchFunc(SwitchFunc fn) { m_switch_fn = fn; }
+
+    /// @brief The current downscale factor, 1 at full resolution.
+    uint32_t GetFactor() const { return m_factor; }
+    /// @brief Width of the frames the current process receives.
+    uint32_t GetWidth() const { return LevelSize(m_options.width, m_factor); }
+    uint32_t GetHeight() const { return LevelSize(m_options.height, m_factor); }
+    /// @brief All switches so far, oldest first.
+    const std::vector<ResolutionSwitch>& GetSwitches() const { return m_switches; }
+    /// @brief The current FFmpeg process.
+    PipePtr GetPipe() const { return m_pipe; }
+
+private:
+    explicit AdaptiveEncoder(AdaptiveOptions options);
+
+    /// @brief A dimension at a downscale factor. Downscaled levels are rounded down to even.
+    static uint32_t LevelSize(uint32_t size, uint32_t factor) { return factor > 1 ? (size / factor) & ~1u : size; }
+
+    /// @brief Start a process for the current factor.
+    PipePtr Start();
+    /// @brief The frame at the current level, downscaled and cropped as needed.
+    const void* Scale(const void* frame, size_t& size);
+    /// @brief Check the last window and request a switch if needed.
+    void Evaluate();
+    /// @brief Switch to the requested factor, writing `frame` as the new process's first.
+    /// @return `false` if the new process failed, in which case the frame is not written.
+    bool Switch(const void* frame);
+    /// @brief Wait for a new process to read its first frame, then check that it keeps running.
+    bool Confirm(const PipePtr& pipe);
+    /// @brief Close a replaced process on the background thread.
+    void Retire(PipePtr pipe);
+
+    AdaptiveOptions m_options;
+    const uint32_t m_bytes_per_pixel;
+    Pipe::PrintFunc m_print_fn = Pipe::DefaultPrintFunc;
+    SwitchFunc m_switch_fn;
+
+    PipePtr m_pipe;
+    std::unique_ptr<StallProfiler> m_profiler;
+    std::thread m_retire_thread;
+    uint64_t m_process_index = 0;
+    uint32_t m_factor = 1;
+    std::vector<uint8_t> m_scaled;
+    /// @brief The factor to switch to on the next Write, or 0, and the verdict of the window that requested it
+    uint32_t m_next_factor = 0;
+    std::string m_next_reason;
+
+    uint64_t m_frame_index = 0;
+    int64_t m_start_qpc = 0;
+    int64_t m_level_start_qpc = 0;
+    uint64_t m_windows_seen = 0;
+    uint32_t m_pressure_windows = 0;
+    uint32_t m_headroom_windows = 0;
+    /// @brief Windows of headroom needed to restore, after backing off
+    uint32_t m_restore_windows = 0;
+    /// @brief Windows spent at the current level, and whether it was entered by a restore
+    uint64_t m_level_windows = 0;
+    bool m_level_restored = false;
+    std::vector<ResolutionSwitch> m_switches;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,178 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+
+namespace ffmpipe
+{
+
+/// @brief Interleaved PCM sample formats
+enum class SampleFormat
+{
+    S16,
+    F32,
+};
+
+/// @brief Bytes per sample of one channel.
+uint32_t BytesPerSample(SampleFormat format);
+/// @brief The name of the format for FFmpeg's `-f` argument, such as `s16le`.
+const char* SampleFormatName(SampleFormat format);
+/// @brief Convert float samples to 16-bit, clamping to [-1, 1].
+void ConvertToS16(const float* src, size_t count, int16_t* dst);
+
+/**
+ * @brief Estimates how far an audio clock drifts from the video clock, and the resampling ratio that cancels it.
+ *
+ * Call Update after each captured audio buffer, with the video clock at the time of capture.
+ * The ratio combines a slowly smoothed estimate of the audio device's true rate with a correction
+ * that pulls the written audio back onto the video clock, so the offset stays bounded over long recordings.
+ * The ratio is clamped to a small range, which keeps pitch changes inaudible.
+ *
+ * Use with Resampler:
+ *   drift.Update(captured_frames, video_seconds, resampler.GetOutputFrames());
+ *   resampler.SetRatio(drift.GetRatio());
+ *   resampler.Process(samples, frames, out);
+ */
+class DriftEstimator
+{
+public:
+    /**
+     * @param sample_rate Nominal sample rate of both the capture and the output.
+     * @param max_correction Largest deviation of the ratio from 1. The default, 0.2%, is inaudible.
+     * @param rate_window_seconds Time constant for smoothing the measured audio rate.
+     * @param settle_seconds Time over which an offset from the video clock is corrected.
+     */
+    explicit DriftEstimator(
+        uint32_t sample_rate, double max_correction = 0.002,
+        double rate_window_seconds = 60, double settle_seconds = 10
+    );
+
+    /**
+     * @param captured_frames Total audio frames captured so far.
+     * @param clock_seconds The video clock when the last of those frames was captured.
+     * @param output_frames Total frames written after resampling, such as Resampler::GetOutputFrames.
+     */
+    void Update(uint64_t captured_frames, double clock_seconds, uint64_t output_frames);
+    void Reset();
+
+    /// @brief Output frames per input frame to resample with.
+    double GetRatio() const { return m_ratio; }
+    /// @brief Measured audio rate relative to nominal, in parts per million. Positive if audio runs fast.
+    double GetDriftPpm() const { return (m_rate / m_sample_rate - 1) * 1e6; }
+    /// @brief Written audio minus the video clock, in seconds. Positive if audio is ahead.
+    double GetOffsetSeconds() const { return m_offset_seconds; }
+
+private:
+    const double m_sample_rate;
+    const double m_max_correction;
+    const double m_rate_window_seconds;
+    const double m_settle_seconds;
+
+    bool m_started = false;
+    uint64_t m_first_captured = 0, m_first_output = 0;
+    double m_first_clock = 0, m_last_clock = 0;
+    /// @brief Exponentially weighted regression state. The slope is the measured rate.
+    double m_weight = 0, m_mean_clock = 0, m_mean_captured = 0, m_covariance = 0, m_variance = 0;
+    double m_rate = 0;
+    double m_ratio = 1;
+    double m_offset_seconds = 0;
+};
+
+/**
+ * @brief Resamples interleaved float audio by a ratio close to 1, which may change between calls.
+ *
+ * A windowed-sinc polyphase filter, evaluated with SSE. The coefficients of neighbouring phases are
+ * interpolated, so any ratio is exact. The filter delays audio by `taps / 2` input frames.
+ *
+ * Not thread-safe.
+ */
+class Resampler
+{
+public:
+    /**
+     * @param taps Filter length in input frames. Rounded up to a multiple of 4.
+     * @param phases Number of precomputed fractional positions.
+     */
+    explicit Resampler(uint32_t channels, uint32_t taps = 32, uint32_t phases = 256);
+    Resampler(const Resampler&) = delete;
+
+    /// @brief Set output frames per input frame. Takes effect from the next frame.
+    void SetRatio(double ratio) { m_step = ratio > 0 ? 1 / ratio : 1; }
+    /**
+     * @brief Resample interleaved frames.
+     * @param out Receives the interleaved output, appended to its contents.
+     * @return Number of frames appended.
+     */
+    size_t Process(const float* in, size_t frames, std::vector<float>& out);
+
+    uint32_t GetChannels() const { return m_channels; }
+    uint64_t GetInputFrames() const { return m_input_frames; }
+    uint64_t GetOutputFrames() const { return m_output_frames; }
+
+private:
+    const uint32_t m_channels, m_taps, m_phases;
+    /// @brief `m_phases + 1` rows of `m_taps` coefficients, so the last phase can interpolate
+    std::vector<float> m_coefficients;
+    /// @brief Pending input per channel, starting at the oldest frame the filter still needs
+    std::vector<std::vector<float>> m_history;
+    /// @brief Position of the next output frame in input frames, relative to the start of the history
+    double m_position = 0;
+    double m_step = 1;
+    uint64_t m_input_frames = 0, m_output_frames = 0;
+};
+
+/**
+ * @brief Mixes several float audio tracks into one PCM stream, so FFmpeg reads a single audio input.
+ *
+ * Capture threads Submit interleaved float samples to their track, and the writing thread calls Mix,
+ * which sums the tracks with their gains using SSE and converts the result once.
+ * All tracks share the mixer's channel count and sample rate.
+ *
+ * Example FFmpeg input for stereo at 48 kHz: `-f s16le -ar 48000 -ac 2 -i -`
+ *
+ * Methods are thread-safe.
+ */
+class Mixer
+{
+public:
+    explicit Mixer(uint32_t channels, SampleFormat output_format = SampleFormat::S16);
+    Mixer(const Mixer&) = delete;
+
+    /// @brief Add a track.
+    /// @return The track's index.
+    size_t AddTrack(float gain = 1);
+    void SetGain(size_t track, float gain);
+    /// @brief Queue interleaved frames for a track.
+    void Submit(size_t track, const float* samples, size_t frames);
+    /**
+     * @brief Mix the frames that every track has queued.
+     * @param out Receives the mixed PCM, appended to its contents.
+     * @param pad_silence Instead, mix as many frames as the fullest track has, treating missing frames as silence.
+     * Use it when a track may stop, such as a muted microphone.
+     * @return Number of frames mixed.
+     */
+    size_t Mix(std::vector<uint8_t>& out, bool pad_silence = false);
+    /// @brief Frames queued on a track.
+    size_t GetQueuedFrames(size_t track) const;
+
+    uint32_t GetChannels() const { return m_channels; }
+    SampleFormat GetOutputFormat() const { return m_output_format; }
+
+private:
+    struct Track
+    {
+        float gain = 1;
+        std::vector<float> samples;
+        /// @brief Index of the first sample not yet mixed
+        size_t read = 0;
+    };
+
+    const uint32_t m_channels;
+    const SampleFormat m_output_format;
+    mutable std::mutex m_mutex;
+    std::vector<Track> m_tracks;
+    std::vector<float> m_mix;
+};
+
+}
\ No newline at end of file
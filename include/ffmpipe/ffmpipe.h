@@ -3,6 +3,10 @@
 #include <string_view>
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <deque>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
@@ -11,16 +15,174 @@ namespace ffmpipe
 
 using PipePtr = std::shared_ptr<class Pipe>;
 
+/// @brief Parameters for Pipe::Create
+struct PipeOptions
+{
+    /// @brief Timeout in milliseconds for reading and writing.
+    DWORD timeout_ms = 10'000;
+    /// @brief Kernel buffer size of FFmpeg's stdin pipe.
+    DWORD stdin_buffer_size = 4096 * 4096;
+    /// @brief Kernel buffer size of FFmpeg's stdout/stderr pipe.
+    DWORD stdout_buffer_size = 4096 * 4096;
+    /**
+     * @brief Keep FFmpeg's stdout separate from its console output, to be read with Pipe::Read.
+     * @details Console output (stderr) is still printed. Use an output such as `-f rawvideo -` to decode frames.
+     */
+    bool read_stdout = false;
+    /// @brief Kernel buffer size of FFmpeg's stdout pipe when `read_stdout` is set.
+    DWORD read_buffer_size = 4096 * 4096;
+    /// @brief Measure the time from each Write until FFmpeg has read all of its data.
+    /// @details Not available with `growing_file`.
+    /// @see PipeStats::latency_last_us
+    bool measure_latency = false;
+    /**
+     * @brief Write to this file instead of FFmpeg's stdin, for FFmpeg to read as it grows.
+     * @details Unlike a pipe, the file keeps recent data after FFmpeg reads it, so a crashed encoder can be
+     * restarted from a byte offset with Pipe::Restart, and Write only waits when FFmpeg falls far behind.
+     * `-i -` in the arguments is replaced to read the file with the file protocol's follow mode.
+     * The file is sparse and temporary, so it stays in the file cache where memory allows.
+     * Place it on a RAM disk to keep it off the physical disk entirely. It is deleted with the Pipe.
+     */
+    std::filesystem::path growing_file;
+    /**
+     * @brief Bytes kept behind the end of `growing_file`. Older data that FFmpeg has encoded is deallocated.
+     * @details Write waits while FFmpeg's progress is further behind than this, so FFmpeg never reads deallocated data.
+     * It must exceed the encoder's delay in bytes, such as its lookahead. Restart can't resume from earlier.
+     */
+    uint64_t growing_file_retain_bytes = 1ull << 30;
+    /**
+     * @brief Size of one input frame in `growing_file`, to tell how far FFmpeg has read from its progress.
+     * @details FFmpeg's reported frame count times this is taken as read, which holds for raw video
+     * at the input frame rate. Without it, nothing is deallocated and Write never waits.
+     */
+    size_t growing_file_frame_size = 0;
+    /// @brief How long FFmpeg waits for `growing_file` to grow before treating it as ended.
+    /// @details FFmpeg finishes this long after Close. A stall in writing longer than this also ends the encode.
+    DWORD growing_file_timeout_ms = 2'000;
+
+    /**
+     * @brief Options for hosting many concurrent pipes.
+     * @details The stdin buffer holds one frame, and the stdout buffer holds a few lines of console output.
+     * Read and Close drain it while they wait, and Write after each completed write.
+     * @param frame_size Size of one frame in bytes, as passed to Pipe::Write.
+     */
+    static PipeOptions Compact(size_t frame_size);
+    /**
+     * @brief Options for interactive streaming, where latency matters more than throughput.
+     * @details At most about one frame is buffered, so a Write blocks until FFmpeg has read the previous frame.
+     * Latency is measured. Combine with LowLatencyInputArgs.
+     * @param frame_size Size of one frame in bytes, as passed to Pipe::Write.
+     */
+    static PipeOptions LowLatency(size_t frame_size);
+};
+
+/// @brief Approximate memory held by one Pipe
+struct PipeMemoryUsage
+{
+    /// @brief Size of the Pipe object itself.
+    /// @details Heap memory it owns, such as its strings, latency samples, and callbacks, is not included.
+    size_t object_bytes = 0;
+    /// @brief Kernel pipe buffers charged to this process.
+    size_t kernel_buffer_bytes = 0;
+    /// @brief Number of open handles.
+    size_t handle_count = 0;
+
+    size_t Total() const { return object_bytes + kernel_buffer_bytes; }
+};
+
+/**
+ * @brief Where the time to start FFmpeg went, in microseconds
+ * @details The phases inside Pipe::Create separate the OS's share from FFmpeg's. From the spawn, the first output
+ * marks FFmpeg's executable and libraries having loaded, the first read its input having opened,
+ * and the first progress line its encoder having initialized and encoded frames. Each is 0 until it happens.
+ * The milestones are seen when Write, Read or Close poll FFmpeg, so each is an upper bound
+ * that includes any time the producer took before its next call.
+ * Pipe::Restart starts a new timeline with only the spawn phase.
+ */
+struct PipeStartup
+{
+    /// @brief Creating the pipes, or the growing file.
+    uint64_t pipes_us = 0;
+    /// @brief Creating the process.
+    uint64_t spawn_us = 0;
+    /// @brief From the start of Create until a Write or Read first saw that FFmpeg had read from stdin.
+    /// @details Never earlier than the producer's first Write. Not available with PipeOptions::growing_file.
+    uint64_t first_read_seen_us = 0;
+    /// @brief From the start of Create until FFmpeg's first console output.
+    uint64_t first_output_us = 0;
+    /// @brief From the start of Create until FFmpeg's first progress line.
+    uint64_t first_progress_us = 0;
+};
+
+/// @brief Progress counters of a Pipe
+struct PipeStats
+{
+    /// @brief Total bytes accepted by FFmpeg's stdin, or written to the growing file.
+    uint64_t bytes_written = 0;
+    /// @brief The last frame number reported by FFmpeg.
+    uint64_t frames = 0;
+    /// @brief The last encoding rate reported by FFmpeg, in frames per second.
+    float fps = 0;
+    /// @brief The last encoding speed reported by FFmpeg, relative to realtime.
+    float speed = 0;
+    /// @brief The last count of dropped frames reported by FFmpeg.
+    uint64_t dropped_frames = 0;
+    /// @brief True while a Write or Close is waiting on FFmpeg.
+    bool busy = false;
+    /// @brief Bytes written to stdin that FFmpeg has not read yet.
+    size_t queued_bytes = 0;
+    /// @brief Kernel buffer size of FFmpeg's stdin pipe.
+    size_t stdin_buffer_size = 0;
+    /// @brief Total time spent in Write, in microseconds.
+    uint64_t write_us = 0;
+    /// @brief Time spent in Write waiting for FFmpeg to read, in microseconds.
+    uint64_t wait_us = 0;
+
+    /// @brief Submit-to-read latency of the last measured Write, in microseconds.
+    /// @details Only measured with PipeOptions::measure_latency. An upper bound: a read is only seen when Write or
+    /// Pipe::PollLatency checks, so without PollLatency it includes the producer's idle time until its next Write.
+    uint64_t latency_last_us = 0;
+    uint64_t latency_max_us = 0;
+    uint64_t latency_total_us = 0;
+    uint64_t latency_samples = 0;
+
+    PipeStartup startup;
+};
+
+/**
+ * @brief FFmpeg input arguments that minimize startup probing and input buffering.
+ * @details Place them before `-i -`. Encoder settings such as `-tune zerolatency` are still up to the caller.
+ */
+std::wstring_view LowLatencyInputArgs();
+
+/// @brief Resource usage of FFmpeg's process
+struct PipeProcessUsage
+{
+    /// @brief User and kernel CPU time, in seconds.
+    double cpu_seconds = 0;
+    /// @brief Working set in bytes.
+    size_t resident_bytes = 0;
+};
+
+/// @brief Quote a command-line argument, such as a file path, so FFmpeg parses it as one argument.
+std::wstring QuoteArg(std::wstring_view arg);
+/**
+ * @brief Identify an FFmpeg build by its executable's path, size and modification time, for keys of cached encodes.
+ * @details Replacing or upgrading the executable changes the identity. Empty if the file can't be read.
+ */
+std::wstring ExecutableIdentity(const std::filesystem::path& path);
+
 /**
  * @brief Run FFmpeg and write to stdin.
  * 
- * Operations are not thread-safe.
+ * Operations are not thread-safe, except for GetStats, GetQueuedBytes, GetProcessUsage, PollLatency, and Terminate.
  */
 class Pipe
 {
 public:
     using PrintFunc = std::function<void(std::string_view)>;
 
+    /// @brief If FFmpeg is still running, Close with the pipe's timeout, then terminate it.
     ~Pipe();
     Pipe(const Pipe&) = delete;
 
@@ -42,6 +204,12 @@ public:
         const std::filesystem::path& ffmpeg_path, std::wstring_view ffmpeg_args,
         DWORD timeout_ms = 10'000
     );
+    /// @brief Create a new pipe and run FFmpeg.
+    /// @see Create
+    static std::shared_ptr<Pipe> Create(
+        const std::filesystem::path& ffmpeg_path, std::wstring_view ffmpeg_args,
+        const PipeOptions& options
+    );
     
     /// @brief A default callback to print FFmpeg's stdout.
     /// @see SetPrintFunc
@@ -52,13 +220,63 @@ public:
     /// @brief Write all data to stdin. Blocking.
     /// @return `false` on failure.
     bool Write(const void* data, size_t length);
+    /**
+     * @brief Read data from stdout. Blocking. Requires PipeOptions::read_stdout.
+     * @param out_read Receives the number of bytes read. May be `nullptr`.
+     * @return `false` on failure or if FFmpeg's output ended before `length` bytes.
+     */
+    bool Read(void* data, size_t length, size_t* out_read = nullptr);
+    /// @brief Read stdout until FFmpeg closes it. Blocking. Requires PipeOptions::read_stdout.
+    /// @param out Receives the data, appended to existing contents.
+    /// @return `false` on failure.
+    bool ReadAll(std::string& out);
     /**
      * @brief Close the stdin handle and wait for program exit. Blocking.
-     * @details Don't call during write operations.
+     * @details Don't call during write operations. FFmpeg's console output is printed while waiting.
      * @param timeout_ms Timeout in milliseconds.
      * @param terminate If true, the child process is terminated after timeout.
      */
     void Close(DWORD timeout_ms = INFINITE, bool terminate = true);
+    /// @brief Report the memory held by this pipe.
+    PipeMemoryUsage GetMemoryUsage() const;
+    /// @brief Get the progress counters. Thread-safe.
+    PipeStats GetStats() const;
+    /// @brief Bytes written to stdin that FFmpeg has not read yet. Thread-safe.
+    /// @details Always 0 with PipeOptions::growing_file.
+    size_t GetQueuedBytes() const;
+    /// @brief Query FFmpeg's CPU time and memory. Thread-safe.
+    PipeProcessUsage GetProcessUsage() const;
+    /// @brief A number identifying this pipe in traces, unique within the process.
+    uint64_t GetId() const { return m_id; }
+    /// @brief FFmpeg's process ID.
+    DWORD GetProcessId() const { return m_procinfo.dwProcessId; }
+    /**
+     * @brief Record the latency of writes that FFmpeg has finished reading since the last check. Thread-safe.
+     * @details Write checks when it starts and ends. Call this from a timer, or watch the pipe with a Watchdog,
+     * so that latency is seen at that resolution rather than at the producer's frame pacing.
+     */
+    void PollLatency();
+    /// @brief Get FFmpeg's exit code, or `STILL_ACTIVE` while it is running.
+    DWORD GetExitCode() const;
+    /// @brief Terminate FFmpeg. Thread-safe.
+    /// @details A blocked Write or Close will return shortly after.
+    void Terminate();
+    /**
+     * @brief Run FFmpeg again, reading the growing file from a byte offset. Requires PipeOptions::growing_file.
+     * @details Use it after FFmpeg crashes, or terminate and replace a running FFmpeg. Writes are not lost meanwhile.
+     * The offset should start a frame, or a packet for containers. Don't call during Write, or after Close.
+     * Not available with PipeOptions::read_stdout.
+     * The thread-safe methods may run meanwhile. They see either the old or the new process, never a closed handle,
+     * so a concurrent Terminate stops whichever process is current.
+     * @param offset From GetRestartOffset to the bytes written so far. With PipeOptions::growing_file_frame_size,
+     * a multiple of the frame size.
+     * @param ffmpeg_args New arguments, or empty to reuse the previous ones.
+     * @return `false` on failure.
+     */
+    bool Restart(uint64_t offset, std::wstring_view ffmpeg_args = {});
+    /// @brief The earliest offset that Restart can resume from. Thread-safe.
+    /// @details A multiple of PipeOptions::growing_file_frame_size, so it starts a frame.
+    uint64_t GetRestartOffset() const;
     
 private:
     Pipe() {}
@@ -66,13 +284,73 @@ private:
     /// @brief Read and print the console output of FFmpeg. Non-blocking.
     /// @return The number of bytes read
     size_t ReadOutput();
+    /// @brief Parse FFmpeg's progress from its console output.
+    void ParseOutput(std::string_view str);
+    /// @brief Parse a single line of output, such as `frame=  120 fps= 60 ... speed=1.99x`
+    void ParseProgressLine(std::string_view line);
+    /// @brief Record when FFmpeg is first seen to have taken any data from stdin.
+    void UpdateFirstRead();
+    /// @brief Microseconds since the start of Create or Restart, at least 1.
+    uint64_t StartupMicroseconds() const;
+    /// @brief Start FFmpeg with `m_ffmpeg_args`.
+    /// @param skip_bytes Bytes at the start of the growing file for FFmpeg to skip.
+    bool Spawn(uint64_t skip_bytes, HANDLE stdout_handle);
+    /// @brief Deallocate the growing file's data that FFmpeg has encoded, beyond the retained bytes.
+    void ReleaseGrowingFile();
+    /// @brief Bytes of the growing file that FFmpeg has encoded, by its reported frame count.
+    uint64_t EncodedBytes() const { return m_spawn_offset + m_frames * m_frame_size; }
+    /// @brief Wait until writing `length` bytes keeps FFmpeg within the retained bytes.
+    /// @return `false` on timeout.
+    bool WaitForGrowingFile(size_t length);
 
+    uint64_t m_id = 0;
+    /// @brief Replaced only by Restart, under `m_process_mutex`, which the thread-safe methods hold to use it
     PROCESS_INFORMATION m_procinfo = {0};
+    mutable std::mutex m_process_mutex;
     HANDLE m_stdin_r = INVALID_HANDLE_VALUE , m_stdin_w = INVALID_HANDLE_VALUE;
     HANDLE m_stdout_r = INVALID_HANDLE_VALUE , m_stdout_w = INVALID_HANDLE_VALUE;
+    HANDLE m_data_r = INVALID_HANDLE_VALUE;
     HANDLE m_event = NULL;
     DWORD m_timeout_ms = 10'000;
+    DWORD m_stdin_buffer_size = 0, m_stdout_buffer_size = 0, m_read_buffer_size = 0;
     PrintFunc m_print_fn = DefaultPrintFunc;
+    std::string m_output_line;
+    std::filesystem::path m_ffmpeg_path;
+    std::wstring m_ffmpeg_args;
+
+    std::filesystem::path m_growing_file;
+    uint64_t m_retain_bytes = 0;
+    size_t m_frame_size = 0;
+    DWORD m_follow_timeout_ms = 0;
+    /// @brief The offset FFmpeg started reading the growing file from
+    std::atomic<uint64_t> m_spawn_offset = 0;
+    /// @brief The growing file's data before this offset has been deallocated
+    std::atomic<uint64_t> m_released_bytes = 0;
+
+    std::atomic<uint64_t> m_bytes_written = 0;
+    std::atomic<uint64_t> m_frames = 0;
+    std::atomic<uint64_t> m_dropped_frames = 0;
+    std::atomic<float> m_fps = 0, m_speed = 0;
+    std::atomic<bool> m_busy = false;
+    /// @brief Performance counter time spent in Write and in its waits, and the start of the current ones or 0.
+    std::atomic<int64_t> m_write_qpc = 0, m_wait_qpc = 0;
+    std::atomic<int64_t> m_write_start_qpc = 0, m_wait_start_qpc = 0;
+
+    /// @brief Start of the latest Create or Restart, and its timeline. See PipeStartup.
+    int64_t m_create_start_qpc = 0;
+    uint64_t m_pipes_us = 0, m_spawn_us = 0;
+    std::atomic<uint64_t> m_first_read_seen_us = 0, m_first_output_us = 0, m_first_progress_us = 0;
+
+    struct PendingWrite
+    {
+        /// @brief Value of m_bytes_written after the write
+        uint64_t end_offset;
+        int64_t submit_qpc;
+    };
+    bool m_measure_latency = false;
+    std::mutex m_latency_mutex;
+    std::deque<PendingWrite> m_pending_writes;
+    std::atomic<uint64_t> m_latency_last_us = 0, m_latency_max_us = 0, m_latency_total_us = 0, m_latency_samples = 0;
 };
 
 }
\ No newline at end of file
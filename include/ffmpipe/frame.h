@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace ffmpipe
+{
+
+class WorkerPool;
+
+/// @brief Pixel formats understood by the frame kernels
+enum class PixelFormat
+{
+    RGB24,
+    BGR24,
+    RGBA,
+    BGRA,
+    /// @brief Planar YUV 4:2:0. Y, then U, then V, each plane tightly packed.
+    I420,
+};
+
+/// @brief Bytes per pixel of a packed format, or 0 for planar formats.
+uint32_t BytesPerPixel(PixelFormat format);
+/// @brief Size of a tightly packed frame in bytes.
+size_t FrameSize(PixelFormat format, uint32_t width, uint32_t height);
+/// @brief The name of the format for FFmpeg's `-pix_fmt` argument.
+const char* PixelFormatName(PixelFormat format);
+
+/**
+ * @brief Downscale a packed frame by averaging each `factor` x `factor` block of pixels.
+ * @details Output is `src_width / factor` x `src_height / factor`. Leftover edge pixels are dropped.
+ * @param src Tightly packed source frame.
+ * @param bytes_per_pixel Bytes per pixel in both frames. Every byte is averaged separately.
+ * @param dst Receives the tightly packed output frame.
+ * @param pool Splits the rows between threads. May be `nullptr`.
+ */
+void Downscale(
+    const uint8_t* src, uint32_t src_width, uint32_t src_height, uint32_t bytes_per_pixel,
+    uint32_t factor, uint8_t* dst, WorkerPool* pool = nullptr
+);
+
+/**
+ * @brief Convert a packed RGB frame to I420 with BT.601 limited-range coefficients.
+ * @details Chroma is the average of each 2x2 block, clamped at odd edges.
+ * @param src Tightly packed source frame in a packed format.
+ * @param dst Receives the tightly packed I420 frame. See FrameSize.
+ * @param pool Splits the rows between threads. May be `nullptr`.
+ */
+void ConvertToI420(
+    const uint8_t* src, PixelFormat src_format, uint32_t width, uint32_t height, uint8_t* dst,
+    WorkerPool* pool = nullptr
+);
+
+/// @brief A rectangle of pixels
+struct FrameRect
+{
+    uint32_t x = 0, y = 0, width = 0, height = 0;
+};
+
+/**
+ * @brief Convert part of a packed RGB frame into an existing I420 frame. See ConvertToI420.
+ * @details The rectangle is widened to even coordinates so each 2x2 chroma block is converted whole,
+ * and clipped to the frame. The rest of `dst` is left untouched.
+ */
+void ConvertToI420Rect(
+    const uint8_t* src, PixelFormat src_format, uint32_t width, uint32_t height, const FrameRect& rect, uint8_t* dst,
+    WorkerPool* pool = nullptr
+);
+
+/// @brief Copies of at least this many bytes bypass the cache in StreamCopy.
+const size_t STREAM_COPY_MIN_SIZE = 1024 * 1024;
+
+/**
+ * @brief Copy a frame without evicting the caller's working set from the CPU caches.
+ * @details Copies of at least STREAM_COPY_MIN_SIZE bytes prefetch the source and write with non-temporal stores,
+ * so a 4K frame passes through without displacing the last-level cache. Smaller copies use memcpy.
+ * Use it where the copy is not read again soon by the same core.
+ * @param pool Splits copies of several STREAM_COPY_MIN_SIZE blocks between threads. May be `nullptr`.
+ */
+void StreamCopy(void* dst, const void* src, size_t size, WorkerPool* pool = nullptr);
+
+/// @brief A fast, non-cryptographic 64-bit hash (XXH64) for comparing frame contents.
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+#include <ffmpipe/frame.h>
+#include <memory>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace ffmpipe
+{
+
+/// @brief How a source frame is converted before it is written
+struct FrameConversion
+{
+    /// @brief A packed format.
+    PixelFormat src_format = PixelFormat::RGB24;
+    uint32_t width = 0, height = 0;
+    /// @brief Downscale by this factor first. See Downscale.
+    uint32_t factor = 1;
+    /// @brief `src_format`, to only scale, or I420.
+    PixelFormat dst_format = PixelFormat::I420;
+
+    uint32_t GetOutputWidth() const { return width / factor; }
+    uint32_t GetOutputHeight() const { return height / factor; }
+};
+
+/// @brief Counters of a FrameCache
+struct FrameCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t max_bytes = 0;
+
+    double HitRate() const { return hits + misses ? (double)hits / (hits + misses) : 0; }
+};
+
+using CachedFrame = std::shared_ptr<const std::vector<uint8_t>>;
+
+/**
+ * @brief Keeps converted frames for sources that are submitted repeatedly, such as slideshows or UI recordings.
+ *
+ * Frames are keyed by a hash of the source contents (HashBytes) and the conversion.
+ * A repeated source costs one hash instead of a conversion.
+ * The least recently used frames are evicted to stay within a byte budget.
+ *
+ * Methods are thread-safe. Conversions run outside the lock.
+ */
+class FrameCache
+{
+public:
+    /// @param max_bytes Budget for converted frames. Frames larger than this are converted but not kept.
+    explicit FrameCache(size_t max_bytes = 256 * 1024 * 1024);
+    FrameCache(const FrameCache&) = delete;
+
+    /**
+     * @brief Get the converted frame, converting it on a miss.
+     * @param src Tightly packed source frame.
+     * @return The tightly packed output frame, or `nullptr` if the conversion is not supported.
+     * Evicted frames stay valid while referenced.
+     */
+    CachedFrame Convert(const void* src, const FrameConversion& conversion);
+    void Clear();
+    FrameCacheStats GetStats() const;
+
+private:
+    struct CacheEntry
+    {
+        CachedFrame frame;
+        std::list<uint64_t>::iterator lru_it;
+    };
+
+    void Insert(uint64_t key, const CachedFrame& frame);
+
+    const size_t m_max_bytes;
+    mutable std::mutex m_mutex;
+    std::list<uint64_t> m_lru; // Most recent first
+    std::unordered_map<uint64_t, CacheEntry> m_cache;
+    size_t m_bytes = 0;
+    uint64_t m_hits = 0, m_misses = 0, m_evictions = 0;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <ffmpipe/frame.h>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+namespace ffmpipe
+{
+
+/// @brief Parameters for FrameServer
+struct FrameServerOptions
+{
+    /// @brief Path of the FFmpeg executable.
+    std::filesystem::path ffmpeg_path;
+    /// @brief Path of the FFprobe executable.
+    std::filesystem::path ffprobe_path;
+    /// @brief Directory for cached keyframe indexes. Uses the temp directory if empty.
+    std::filesystem::path index_dir;
+    /// @brief A packed format for decoded frames.
+    PixelFormat format = PixelFormat::RGB24;
+    /// @brief Memory for caching decoded frames.
+    size_t cache_bytes = 512 * 1024 * 1024;
+    /// @brief Maximum number of FFmpeg decode processes kept running.
+    size_t max_decoders = 2;
+    PipeOptions pipe_options;
+};
+
+/**
+ * @brief Random access to the frames of a video.
+ * 
+ * A keyframe index is built with FFprobe once, and cached on disk for later opens of the same file.
+ * Frames are decoded from the nearest keyframe by FFmpeg processes that stay running,
+ * so reading forward continues an existing decode instead of starting a new one.
+ * Every decoded frame is kept in a fixed-size LRU cache, so nearby seeks are served from memory.
+ * 
+ * Operations are not thread-safe.
+ */
+class FrameServer
+{
+public:
+    struct CacheStats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t frames_decoded = 0;
+        uint64_t decoders_started = 0;
+    };
+
+    ~FrameServer();
+    FrameServer(const FrameServer&) = delete;
+
+    /// @brief Open a video and load or build its keyframe index. Blocking.
+    /// @return `nullptr` on failure.
+    static std::shared_ptr<FrameServer> Open(const std::filesystem::path& video_path, const FrameServerOptions& options);
+
+    /**
+     * @brief Get a decoded frame. Blocking.
+     * @return `nullptr` on failure. The frame is valid until the next call.
+     */
+    const uint8_t* GetFrame(uint64_t index);
+
+    uint32_t GetWidth() const { return m_width; }
+    uint32_t GetHeight() const { return m_height; }
+    size_t GetFrameSize() const { return m_frame_size; }
+    uint64_t GetFrameCount() const { return m_pts.size(); }
+    const CacheStats& GetCacheStats() const { return m_stats; }
+    /// @brief Set the callback for printing FFmpeg's console output.
+    void SetPrintFunc(Pipe::PrintFunc fn) { m_print_fn = fn; }
+
+private:
+    struct Decoder
+    {
+        PipePtr pipe;
+        uint64_t next_frame = 0;
+        uint64_t last_used = 0;
+    };
+
+    struct CacheEntry
+    {
+        size_t slot;
+        std::list<uint64_t>::iterator lru_it;
+    };
+
+    FrameServer() {}
+
+    bool LoadIndex(const std::filesystem::path& index_path);
+    bool SaveIndex(const std::filesystem::path& index_path) const;
+    bool BuildIndex();
+
+    /// @brief The last keyframe at or before `index`.
+    uint64_t KeyframeBefore(uint64_t index) const;
+    Decoder* FindDecoder(uint64_t index);
+    Decoder* StartDecoder(uint64_t keyframe);
+    /// @brief Take a free cache slot, evicting the least recently used frame if needed.
+    size_t AcquireSlot();
+    void Insert(uint64_t index, size_t slot);
+
+    std::filesystem::path m_video_path;
+    FrameServerOptions m_options;
+    Pipe::PrintFunc m_print_fn = Pipe::DefaultPrintFunc;
+
+    uint32_t m_width = 0, m_height = 0;
+    size_t m_frame_size = 0;
+    /// @brief Stream time base
+    int64_t m_time_base_num = 1, m_time_base_den = 1;
+    /// @brief Presentation timestamp of each frame, in display order
+    std::vector<int64_t> m_pts;
+    /// @brief Sorted indexes of keyframes
+    std::vector<uint64_t> m_keyframes;
+
+    std::vector<Decoder> m_decoders;
+    uint64_t m_use_counter = 0;
+
+    std::unique_ptr<uint8_t[]> m_arena;
+    size_t m_num_slots = 0;
+    std::vector<size_t> m_free_slots;
+    std::list<uint64_t> m_lru; // Most recent first
+    std::unordered_map<uint64_t, CacheEntry> m_cache;
+    CacheStats m_stats;
+};
+
+}
@@ -0,0 +1,295 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <ffmpipe/frame.h>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+namespace ffmpipe
+{
+
+/// @brief A frame buffer. Returned to its pool when the last reference is released.
+struct Frame
+{
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    uint32_t width = 0, height = 0;
+    PixelFormat format = PixelFormat::RGB24;
+    /// @brief Index of the source frame
+    uint64_t index = 0;
+};
+
+using FramePtr = std::shared_ptr<Frame>;
+
+/**
+ * @brief Reuses frame buffers of any size.
+ * 
+ * Methods are thread-safe.
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+public:
+    /// @param max_free_bytes Free buffers beyond this total are deleted instead of kept.
+    static std::shared_ptr<BufferPool> Create(size_t max_free_bytes = 256 * 1024 * 1024);
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+
+    /// @brief Get a frame with a buffer of at least `size` bytes. Its other fields are reset.
+    FramePtr Acquire(size_t size);
+
+private:
+    BufferPool() {}
+    void Release(uint8_t* data, size_t size);
+
+    size_t m_max_free_bytes = 0;
+    size_t m_free_bytes = 0;
+    std::mutex m_mutex;
+    std::unordered_map<size_t, std::vector<uint8_t*>> m_free;
+};
+
+/**
+ * @brief A bounded, lock-free queue for one producer thread and one consumer thread.
+ * @tparam T A movable type.
+ */
+template <class T>
+class SpscQueue
+{
+public:
+    /// @param capacity Rounded up to a power of two.
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    /// @brief Producer only. Returns `false` if full, leaving `value` untouched.
+    bool TryPush(T& value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+            return false;
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Consumer only. Returns `false` if empty.
+    bool TryPop(T& out)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        out = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Approximate number of queued items. Safe from any thread.
+    size_t Size() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+    size_t Capacity() const { return m_mask + 1; }
+
+private:
+    std::vector<T> m_slots;
+    size_t m_mask = 0;
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+};
+
+/// @brief Threading and batching of a stage
+struct StageOptions
+{
+    /// @brief Run on a dedicated thread with an input queue. Otherwise, run on the upstream stage's thread.
+    bool threaded = true;
+    /// @brief Capacity of the input queue. Upstream blocks while it is full.
+    size_t queue_capacity = 4;
+    /// @brief Most queued frames to process per wakeup.
+    size_t batch_size = 1;
+};
+
+/// @brief Counters of a stage. Compare busy time to wall time to find the bottleneck.
+struct StageStats
+{
+    std::string name;
+    uint64_t frames_in = 0;
+    uint64_t frames_out = 0;
+    uint64_t frames_dropped = 0;
+    /// @brief Time spent in Process
+    uint64_t busy_us = 0;
+    /// @brief Time spent waiting for a full downstream queue
+    uint64_t blocked_us = 0;
+    size_t queue_size = 0;
+    size_t queue_capacity = 0;
+};
+
+/**
+ * @brief A step in a FrameGraph.
+ * 
+ * Derive from this and implement Process, calling Emit for each output frame.
+ */
+class Stage
+{
+public:
+    explicit Stage(std::string name) : m_name(std::move(name)) {}
+    virtual ~Stage();
+    Stage(const Stage&) = delete;
+
+    const std::string& GetName() const { return m_name; }
+    StageStats GetStats() const;
+
+protected:
+    /// @brief Process one frame. Return `false` on failure, which drops the remaining frames.
+    virtual bool Process(const FramePtr& frame) = 0;
+    /// @brief Called at the end of the stream, before it reaches downstream stages.
+    virtual void Flush() {}
+
+    /// @brief Send a frame to every downstream stage.
+    void Emit(const FramePtr& frame);
+    /// @brief Count a frame that was intentionally not emitted.
+    void CountDrop() { ++m_frames_dropped; }
+    /// @brief Get a frame from the graph's shared pool.
+    FramePtr NewFrame(size_t size) { return m_pool->Acquire(size); }
+
+private:
+    friend class FrameGraph;
+
+    /// @brief Accept a frame from upstream. `nullptr` marks the end of the stream.
+    void Deliver(FramePtr frame);
+    void Run(const FramePtr& frame);
+    bool Start();
+    void Join();
+    /// @brief End the thread without flushing or forwarding the end of the stream, for a graph that failed to start.
+    void Stop();
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    std::string m_name;
+    StageOptions m_options;
+    std::shared_ptr<BufferPool> m_pool;
+    std::vector<Stage*> m_downstream;
+    /// @brief Charges time blocked on this stage's full queue to the upstream stage
+    std::function<void(uint64_t us)> m_upstream_blocked_us = [](uint64_t) {};
+    bool m_failed = false;
+    /// @brief Set by Stop before its end marker is queued, which publishes it to the thread
+    bool m_stopping = false;
+
+    std::unique_ptr<SpscQueue<FramePtr>> m_queue;
+    HANDLE m_not_empty = NULL, m_not_full = NULL;
+    HANDLE m_thread = NULL;
+
+    std::atomic<uint64_t> m_frames_in = 0, m_frames_out = 0, m_frames_dropped = 0;
+    std::atomic<uint64_t> m_busy_us = 0, m_blocked_us = 0;
+    /// @brief Time spent running inline downstream stages
+    uint64_t m_inline_us = 0;
+};
+
+/**
+ * @brief Connects stages that process frames before they reach a Pipe.
+ * 
+ * Frames are pushed into the first stage added. Each stage may feed several downstream stages,
+ * but has only one upstream stage. Threaded stages are joined by lock-free queues.
+ * Frames are reference counted, so fanning out does not copy them.
+ * 
+ * Build the graph, then Start, Push from a single thread, and Finish.
+ */
+class FrameGraph
+{
+public:
+    FrameGraph();
+    ~FrameGraph();
+    FrameGraph(const FrameGraph&) = delete;
+
+    /// @brief Add a stage. The graph owns it.
+    template <class T, class... Args>
+    T* Add(const StageOptions& options, Args&&... args)
+    {
+        T* stage = new T(std::forward<Args>(args)...);
+        AddStage(std::unique_ptr<Stage>(stage), options);
+        return stage;
+    }
+    /// @brief Send the output of `from` to `to`.
+    void Connect(Stage* from, Stage* to) { from->m_downstream.push_back(to); }
+
+    /// @brief Start threads for threaded stages. On failure, the threads already started are ended.
+    bool Start();
+    /// @brief Get an empty frame from the shared pool.
+    FramePtr NewFrame(size_t size) { return m_pool->Acquire(size); }
+    /// @brief Send a frame into the graph. Blocks while the first stage's queue is full.
+    void Push(FramePtr frame);
+    /// @brief Copy a tightly packed frame into a pooled buffer and send it into the graph.
+    void Push(const void* data, uint32_t width, uint32_t height, PixelFormat format);
+    /// @brief End the stream and wait for every stage to process its frames.
+    void Finish();
+
+    std::vector<StageStats> GetStats() const;
+    /// @brief One line per stage, marking the stage with the most busy time.
+    std::string Report() const;
+
+private:
+    void AddStage(std::unique_ptr<Stage> stage, const StageOptions& options);
+
+    std::shared_ptr<BufferPool> m_pool;
+    std::vector<std::unique_ptr<Stage>> m_stages;
+    uint64_t m_next_index = 0;
+    bool m_started = false;
+    int64_t m_start_qpc = 0;
+};
+
+/// @brief Converts packed RGB frames to I420
+class ConvertStage : public Stage
+{
+public:
+    ConvertStage() : Stage("convert") {}
+protected:
+    bool Process(const FramePtr& frame) override;
+};
+
+/// @brief Downscales packed frames by an integer factor
+class ScaleStage : public Stage
+{
+public:
+    explicit ScaleStage(uint32_t factor) : Stage("scale"), m_factor(factor ? factor : 1) {}
+protected:
+    bool Process(const FramePtr& frame) override;
+private:
+    uint32_t m_factor;
+};
+
+/// @brief Drops frames identical to the previous frame
+class DedupeStage : public Stage
+{
+public:
+    DedupeStage() : Stage("dedupe") {}
+protected:
+    bool Process(const FramePtr& frame) override;
+private:
+    uint64_t m_last_hash = 0;
+    size_t m_last_size = 0;
+    bool m_has_last = false;
+};
+
+/// @brief Passes each frame to every downstream stage
+class TeeStage : public Stage
+{
+public:
+    TeeStage() : Stage("tee") {}
+protected:
+    bool Process(const FramePtr& frame) override;
+};
+
+/// @brief Writes frames to a Pipe, and closes it at the end of the stream
+class PipeSinkStage : public Stage
+{
+public:
+    explicit PipeSinkStage(PipePtr pipe) : Stage("pipe"), m_pipe(std::move(pipe)) {}
+protected:
+    bool Process(const FramePtr& frame) override;
+    void Flush() override;
+private:
+    PipePtr m_pipe;
+};
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <ffmpipe/frame_cache.h>
+#include <ffmpipe/segment_cache.h>
+#include <vector>
+#include <mutex>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief Renders the statistics of named pipes, frame caches and segment caches in the OpenMetrics text format, for Prometheus.
+ * 
+ * Pipes and caches are held weakly and disappear from the output once destroyed.
+ * Rendering reads the pipes' atomic counters and queries each FFmpeg process's CPU time and memory.
+ * 
+ * Methods are thread-safe.
+ */
+class MetricsRegistry
+{
+public:
+    /// @brief Export a pipe with the label `pipe="<name>"`.
+    void Add(std::string name, const PipePtr& pipe);
+    /// @brief Export a frame cache with the label `cache="<name>"`.
+    void AddCache(std::string name, const std::shared_ptr<FrameCache>& cache);
+    /// @brief Export a segment cache with the label `cache="<name>"`.
+    void AddCache(std::string name, const std::shared_ptr<SegmentCache>& cache);
+    /// @brief Stop exporting the pipes and caches with this name.
+    void Remove(std::string_view name);
+
+    /// @brief Render every pipe's and cache's metrics, ending with `# EOF`.
+    std::string Render();
+    /**
+     * @brief Write the metrics to a file for node_exporter's textfile collector.
+     * @details The file is replaced atomically, so the collector never reads a partial file.
+     * The collector expects the Prometheus text format 0.0.4, so unlike Render, counter families are named
+     * with their `_total` suffix, and there are no `# UNIT` or `# EOF` lines.
+     * @return `false` on failure.
+     */
+    bool WriteTextfile(const std::filesystem::path& path);
+
+private:
+    /// @brief Render in OpenMetrics, or else in the Prometheus text format 0.0.4.
+    std::string Render(bool openmetrics);
+
+    std::mutex m_mutex;
+    std::vector<std::pair<std::string, std::weak_ptr<Pipe>>> m_pipes;
+    std::vector<std::pair<std::string, std::weak_ptr<FrameCache>>> m_caches;
+    std::vector<std::pair<std::string, std::weak_ptr<SegmentCache>>> m_segment_caches;
+};
+
+/**
+ * @brief A minimal HTTP server on the loopback interface that serves `GET /metrics`.
+ * 
+ * Requests are handled one at a time on a background thread.
+ */
+class MetricsServer
+{
+public:
+    explicit MetricsServer(std::shared_ptr<MetricsRegistry> registry);
+    ~MetricsServer();
+    MetricsServer(const MetricsServer&) = delete;
+
+    /// @brief Listen on 127.0.0.1 and start serving.
+    /// @return `false` on failure.
+    bool Start(uint16_t port);
+    void Stop();
+
+private:
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    void Serve(uintptr_t client);
+
+    std::shared_ptr<MetricsRegistry> m_registry;
+    uintptr_t m_socket;
+    bool m_wsa_started = false;
+    HANDLE m_thread = NULL;
+};
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <ffmpipe/frame.h>
+#include <vector>
+#include <mutex>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief Produce low-rate, downscaled copies of frames for previews.
+ * 
+ * Call Submit with each frame before Pipe::Write.
+ * Every `interval` frames, the frame is copied and downscaled on a low-priority thread.
+ * If that thread is still busy, the frame is skipped, so Submit never waits.
+ * 
+ * Submit must be called from one thread. GetPreview is thread-safe.
+ */
+class PreviewTap
+{
+public:
+    /**
+     * @param format A packed format. The preview has the same format.
+     * @param factor The preview is `width / factor` x `height / factor`.
+     * @param interval Take a preview every `interval` frames.
+     */
+    PreviewTap(uint32_t width, uint32_t height, PixelFormat format, uint32_t factor, uint32_t interval);
+    ~PreviewTap();
+    PreviewTap(const PreviewTap&) = delete;
+
+    /// @brief Offer a frame. Non-blocking.
+    /// @return `true` if the frame was taken for a preview.
+    bool Submit(const void* frame);
+    /**
+     * @brief Copy the latest preview.
+     * @param out Receives the preview frame.
+     * @param out_frame_index Receives the index of the submitted frame. May be `nullptr`.
+     * @return `false` if there is no preview yet.
+     */
+    bool GetPreview(std::vector<uint8_t>& out, uint64_t* out_frame_index = nullptr) const;
+    uint32_t GetPreviewWidth() const { return m_width / m_factor; }
+    uint32_t GetPreviewHeight() const { return m_height / m_factor; }
+    /// @brief Number of previews skipped because the thread was busy.
+    uint64_t GetSkippedCount() const { return m_skipped; }
+
+private:
+    static DWORD WINAPI ThreadProc(LPVOID param);
+
+    const uint32_t m_width, m_height, m_bytes_per_pixel, m_factor, m_interval;
+    uint64_t m_frame_index = 0;
+    std::atomic<uint64_t> m_skipped = 0;
+
+    /// @brief Full-size copy of a submitted frame. Owned by the thread while `m_staging_busy` is set.
+    std::vector<uint8_t> m_staging;
+    uint64_t m_staging_index = 0;
+    std::atomic<bool> m_staging_busy = false;
+
+    /// @brief Double buffer. The thread writes the back buffer, then swaps it to the front.
+    std::vector<uint8_t> m_previews[2];
+    uint64_t m_preview_index = 0;
+    bool m_has_preview = false;
+    size_t m_front = 0;
+    mutable std::mutex m_front_mutex;
+
+    std::atomic<bool> m_stop = false;
+    HANDLE m_work_event = NULL;
+    HANDLE m_thread = NULL;
+};
+
+}
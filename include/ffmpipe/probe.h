@@ -0,0 +1,91 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+namespace ffmpipe
+{
+
+/// @brief A stream reported by FFprobe. Fields missing from the stream are left at their defaults.
+struct ProbeStream
+{
+    int index = 0;
+    /// @brief "video", "audio", "subtitle", or "data"
+    std::string codec_type;
+    std::string codec_name;
+    /// @brief Pixel format of video streams
+    std::string pix_fmt;
+    /// @brief Sample format of audio streams
+    std::string sample_fmt;
+    uint32_t width = 0, height = 0;
+    /// @brief Average frame rate as a fraction
+    int64_t frame_rate_num = 0, frame_rate_den = 1;
+    uint32_t sample_rate = 0;
+    uint32_t channels = 0;
+    /// @brief Duration in seconds
+    double duration = 0;
+    uint64_t nb_frames = 0;
+    int64_t bit_rate = 0;
+};
+
+/// @brief Media information reported by FFprobe
+struct ProbeResult
+{
+    std::string format_name;
+    /// @brief Duration in seconds
+    double duration = 0;
+    uint64_t size = 0;
+    int64_t bit_rate = 0;
+    std::vector<ProbeStream> streams;
+};
+
+/**
+ * @brief Parse the output of `ffprobe -print_format json -show_format -show_streams`.
+ * @details Uses a pull parser over the text. Only the fields in ProbeResult are copied.
+ * @return `false` if the JSON is malformed.
+ */
+bool ParseProbeJson(std::string_view json, ProbeResult& out);
+
+/**
+ * @brief Run FFprobe on media files and cache the results.
+ * 
+ * Results are keyed by path, size, and modification time, so a repeat probe of an unchanged file costs one stat.
+ * 
+ * Methods are thread-safe.
+ */
+class ProbeCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    /// @param ffprobe_path Path of the FFprobe executable.
+    explicit ProbeCache(std::filesystem::path ffprobe_path, PipeOptions options = PipeOptions());
+    ProbeCache(const ProbeCache&) = delete;
+
+    /// @brief Probe a media file, or return the cached result. Blocking.
+    /// @return `nullptr` on failure.
+    std::shared_ptr<const ProbeResult> Probe(const std::filesystem::path& media_path);
+    void Clear();
+    Stats GetStats() const;
+
+private:
+    struct Entry
+    {
+        uint64_t size;
+        uint64_t mtime;
+        std::shared_ptr<const ProbeResult> result;
+    };
+
+    std::filesystem::path m_ffprobe_path;
+    PipeOptions m_options;
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::wstring, Entry> m_entries;
+    Stats m_stats;
+};
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <deque>
+
+namespace ffmpipe
+{
+
+/// @brief Where a Pipe's wall time went
+struct StallBreakdown
+{
+    /// @brief Wall time covered, in seconds
+    double wall_s = 0;
+    /// @brief Time outside of Write. The producer was busy making frames.
+    double producer_idle_s = 0;
+    /// @brief Time waiting in Write in windows where FFmpeg reported new frames. Encoding is the limit.
+    double encoder_bound_s = 0;
+    /// @brief Time waiting in Write in windows where FFmpeg reported no new frames. FFmpeg was not reading the full pipe.
+    double pipe_blocked_s = 0;
+    /// @brief Time in Write that was not spent waiting, such as copying into the pipe.
+    double write_overhead_s = 0;
+    /// @brief Average fill level of the stdin pipe, from 0 to 1
+    double pipe_fill = 0;
+    /// @brief Last encoding speed reported by FFmpeg, relative to realtime
+    float encoder_speed = 0;
+
+    /// @brief A one-line summary, such as `encoder-bound: 81% encoder, 12% producer, 2% pipe (speed 0.93x, pipe 97% full)`
+    std::string Verdict() const;
+};
+
+/**
+ * @brief Attribute a Pipe's wall time to the producer, the pipe, or the encoder.
+ * 
+ * Call Sample regularly, such as once per frame or from a timer.
+ * Each sample compares the pipe's counters to the previous sample: time outside Write is producer time.
+ * Samples are grouped into fixed windows, and the breakdown covers the most recent windows.
+ * FFmpeg reports its frame count only about every 500 ms, so time waiting in Write is attributed per window,
+ * by whether FFmpeg made progress over the whole window. Windows shorter than that count as progressing
+ * while FFmpeg's last reported speed is nonzero.
+ * 
+ * Operations are not thread-safe. The pipe may be written from another thread.
+ */
+class StallProfiler
+{
+public:
+    /**
+     * @param window_ms Length of each window in milliseconds.
+     * @param window_count Number of windows in the sliding breakdown.
+     */
+    StallProfiler(PipePtr pipe, DWORD window_ms = 1000, size_t window_count = 10);
+
+    void Sample();
+    /// @brief Breakdown over the completed windows, plus the current one.
+    StallBreakdown GetBreakdown() const;
+    /// @brief Breakdown of the most recently completed window.
+    StallBreakdown GetLastWindow() const;
+    /// @brief Number of windows completed so far.
+    uint64_t GetWindowCount() const { return m_completed_windows; }
+
+private:
+    static void Add(StallBreakdown& total, const StallBreakdown& window);
+    /// @brief The current window up to the last sample, with its waits attributed.
+    StallBreakdown CurrentWindow() const;
+
+    PipePtr m_pipe;
+    DWORD m_window_ms;
+    size_t m_window_count;
+
+    PipeStats m_last_stats;
+    int64_t m_last_sample_qpc = 0;
+    int64_t m_window_start_qpc = 0;
+    double m_fill_sum = 0;
+    uint64_t m_fill_samples = 0;
+    /// @brief Time waiting in Write during the current window, and FFmpeg's frame count at its start
+    double m_window_wait_s = 0;
+    uint64_t m_window_start_frames = 0;
+
+    StallBreakdown m_current;
+    std::deque<StallBreakdown> m_windows;
+    uint64_t m_completed_windows = 0;
+};
+
+}
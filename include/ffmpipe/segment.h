@@ -0,0 +1,182 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <ffmpipe/segment_cache.h>
+#include <vector>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief Produce one frame.
+ * @param index Index of the frame, starting at 0.
+ * @param buffer Receives the frame. Its size is the frame size given to the encoder.
+ * @return `false` on failure.
+ */
+using FrameSource = std::function<bool(uint64_t index, void* buffer)>;
+
+/**
+ * @brief Join segments into one file without re-encoding. Blocking.
+ * @details Uses FFmpeg's concat demuxer. Segments must share the same codec parameters.
+ * @param list_path Path to write the temporary segment list.
+ * @return `false` on failure.
+ */
+bool ConcatSegments(
+    const std::filesystem::path& ffmpeg_path, const std::vector<std::filesystem::path>& segments,
+    const std::filesystem::path& output_path, const std::filesystem::path& list_path,
+    Pipe::PrintFunc print_fn = Pipe::DefaultPrintFunc
+);
+
+/// @brief Parameters for ResumableEncoder
+struct ResumableEncodeOptions
+{
+    /// @brief Path of the FFmpeg executable.
+    std::filesystem::path ffmpeg_path;
+    /// @brief Arguments describing the input frames, excluding `-i -`.
+    /// @details Example: `-f rawvideo -pix_fmt rgb24 -s:v 1280x720 -framerate 60`
+    std::wstring input_args;
+    /// @brief Arguments for encoding each segment, excluding the output file.
+    /// @details Example: `-c:v libx264 -preset fast`
+    std::wstring output_args;
+    /// @brief The final output file. Its extension also selects the segment format.
+    std::filesystem::path output_path;
+    /// @brief Size of one frame in bytes.
+    size_t frame_size = 0;
+    /// @brief Number of frames per segment. At most this many frames are lost to a crash.
+    uint64_t frames_per_segment = 60 * 60;
+    /**
+     * @brief Reuse encoded segments whose frames and arguments match, from this or earlier jobs, or `nullptr`.
+     * @details Each segment's frames are read once to look it up, and read again if it has to be encoded.
+     * Jobs only share segments that start on the same frame within identical runs of frames,
+     * so keep `frames_per_segment` the same across revisions. Segments are keyed by the FFmpeg executable too,
+     * so replacing it starts over rather than reusing another build's output.
+     */
+    std::shared_ptr<SegmentCache> cache;
+    PipeOptions pipe_options;
+};
+
+/**
+ * @brief Encode a long sequence of frames so it can resume after a crash.
+ * 
+ * Frames are encoded into independently decodable segments, next to the output in `<output>.segments`.
+ * A journal records the last completed segment.
+ * When run again with the same options, encoding resumes at the first incomplete segment.
+ * Finally, the segments are joined into the output file and the segment directory is removed.
+ * 
+ * With a SegmentCache, segments found in the cache skip FFmpeg, and encoded segments are added to it.
+ * Cached and encoded segments are joined the same way, without re-encoding.
+ */
+class ResumableEncoder
+{
+public:
+    explicit ResumableEncoder(ResumableEncodeOptions options);
+
+    /**
+     * @brief Encode all frames, resuming from the journal if one exists. Blocking.
+     * @param total_frames Number of frames in the whole encode.
+     * @param source Produces each frame. It is only asked for frames that were not encoded yet.
+     * @return `false` on failure. The journal is kept, so a later call resumes.
+     */
+    bool Run(uint64_t total_frames, const FrameSource& source);
+    /// @brief The first frame that a call to Run would encode.
+    uint64_t GetResumeFrame() const { return m_completed_segments * m_options.frames_per_segment; }
+    /// @brief Set the callback for printing FFmpeg's stdout.
+    void SetPrintFunc(Pipe::PrintFunc fn) { m_print_fn = fn; }
+
+private:
+    std::filesystem::path SegmentPath(uint64_t segment) const;
+    std::filesystem::path JournalPath() const;
+    void LoadJournal();
+    bool SaveJournal(uint64_t last_frame);
+    bool EncodeSegment(uint64_t segment, uint64_t first_frame, uint64_t num_frames, const FrameSource& source, uint8_t* buffer);
+    /// @brief Take the segment from the cache, or encode it and add it.
+    bool EncodeCachedSegment(uint64_t segment, uint64_t first_frame, uint64_t num_frames, const FrameSource& source, uint8_t* buffer);
+
+    ResumableEncodeOptions m_options;
+    std::filesystem::path m_segment_dir;
+    uint64_t m_completed_segments = 0;
+    Pipe::PrintFunc m_print_fn = Pipe::DefaultPrintFunc;
+};
+
+/**
+ * @brief Produce one frame of a clip.
+ * @param clip Index of the clip, starting at 0.
+ * @param index Index of the frame within the clip, starting at 0.
+ * @param buffer Receives the frame. Its size is the frame size given to the encoder.
+ * @return `false` on failure.
+ */
+using ClipFrameSource = std::function<bool(uint64_t clip, uint64_t index, void* buffer)>;
+
+/// @brief Parameters for ClipBatch
+struct ClipBatchOptions
+{
+    /// @brief Path of the FFmpeg executable.
+    std::filesystem::path ffmpeg_path;
+    /// @brief Arguments describing the input frames, excluding `-i -`.
+    /// @details Example: `-f rawvideo -pix_fmt rgb24 -s:v 320x180 -framerate 30`
+    std::wstring input_args;
+    /// @brief Frame rate of the input, for placing keyframes at clip boundaries.
+    double framerate = 30;
+    /// @brief Arguments for encoding the clips, excluding the output file.
+    /// @details Example: `-c:v libx264 -preset veryfast`
+    std::wstring output_args;
+    /// @brief Directory for the clips, which are named `clip_000000` onwards.
+    std::filesystem::path output_dir;
+    /// @brief Extension of the clips, which also selects their format. Example: `.mp4`
+    std::wstring output_extension = L".mp4";
+    /// @brief Size of one frame in bytes.
+    size_t frame_size = 0;
+    PipeOptions pipe_options;
+};
+
+/**
+ * @brief Encode many short clips with one FFmpeg process, instead of one process per clip.
+ * 
+ * The clips are written as one stream into FFmpeg's segment muxer, which starts a new file at each clip.
+ * A keyframe is forced on the first frame of every clip, so each file starts cleanly and timestamps restart at 0.
+ * FFmpeg lists each file once it is finalized, and the list is polled while writing to report finished clips.
+ * 
+ * Clip boundaries are passed on the command line, which has a limited length.
+ * Batches of more than a few thousand clips are split across several processes.
+ */
+class ClipBatch
+{
+public:
+    using ClipFunc = std::function<void(uint64_t clip, const std::filesystem::path& path)>;
+
+    explicit ClipBatch(ClipBatchOptions options);
+
+    /**
+     * @brief Encode all clips. Blocking.
+     * @param clip_frames Number of frames of each clip. Every clip needs at least one frame.
+     * @param source Produces each frame of each clip, in order.
+     * @return `false` on failure. Clips reported so far are complete.
+     */
+    bool Run(const std::vector<uint64_t>& clip_frames, const ClipFrameSource& source);
+    /// @brief The file of a clip.
+    std::filesystem::path ClipPath(uint64_t clip) const;
+    /// @brief Set the callback for each finalized clip. It is called from Run.
+    void SetClipFunc(ClipFunc fn) { m_clip_fn = fn; }
+    /// @brief Set the callback for printing FFmpeg's stdout.
+    void SetPrintFunc(Pipe::PrintFunc fn) { m_print_fn = fn; }
+    /// @brief Number of FFmpeg processes started by the last Run.
+    uint64_t GetProcessCount() const { return m_process_count; }
+
+private:
+    /// @brief Encode clips `[first_clip, end_clip)` with one process.
+    bool EncodeRun(
+        uint64_t first_clip, uint64_t end_clip, const std::vector<uint64_t>& clip_frames,
+        const ClipFrameSource& source, uint8_t* buffer
+    );
+    /// @brief Report the clips that FFmpeg has added to the segment list since the last poll.
+    void PollList(const std::filesystem::path& list_path);
+
+    ClipBatchOptions m_options;
+    ClipFunc m_clip_fn;
+    Pipe::PrintFunc m_print_fn = Pipe::DefaultPrintFunc;
+    uint64_t m_process_count = 0;
+    /// @brief The next clip to report, and how much of the segment list has been read
+    uint64_t m_next_clip = 0;
+    uint64_t m_list_offset = 0;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief Identifies an encoded segment by its input frames and how they were encoded.
+ * @details Two independently seeded HashBytes chains make a 128-bit key, so a collision,
+ * which would silently reuse the wrong video, is out of reach even for a large farm's cache.
+ */
+struct SegmentKey
+{
+    /// @param encode_args Everything that affects the output besides the frames, such as the FFmpeg build and the input and output arguments.
+    explicit SegmentKey(std::wstring_view encode_args);
+
+    /// @brief Add the next input frame.
+    void AddFrame(const void* frame, size_t size);
+    /// @brief The key as 32 hexadecimal digits.
+    std::string ToString() const;
+
+    uint64_t hash[2] = {};
+};
+
+/// @brief Counters of a SegmentCache
+struct SegmentCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t max_bytes = 0;
+
+    double HitRate() const { return hits + misses ? (double)hits / (hits + misses) : 0; }
+};
+
+/**
+ * @brief Keeps encoded segments on local disk, so later jobs with the same frames and arguments skip encoding them.
+ *
+ * Segments are files named by their SegmentKey. They are placed into and taken from the cache with
+ * hard links where the volume allows, and copied otherwise, so an eviction never removes a file a job still uses.
+ * The least recently used segments are evicted to stay within a byte budget. Use times are kept
+ * as the files' modification times, so the order survives between processes.
+ *
+ * Methods are thread-safe. Processes sharing a directory each enforce the budget from their own view of it.
+ */
+class SegmentCache
+{
+public:
+    /// @param max_bytes Budget for the directory. Segments larger than this are not kept.
+    explicit SegmentCache(std::filesystem::path dir, uint64_t max_bytes = 16ull << 30);
+    SegmentCache(const SegmentCache&) = delete;
+
+    /**
+     * @brief Place the cached segment at `path`, replacing any file there.
+     * @param path Where the segment is needed. Its extension is part of the lookup.
+     * @return `false` on a miss.
+     */
+    bool Fetch(const SegmentKey& key, const std::filesystem::path& path);
+    /**
+     * @brief Add an encoded segment.
+     * @param path The segment. It is left in place.
+     * @return `false` on failure.
+     */
+    bool Store(const SegmentKey& key, const std::filesystem::path& path);
+    /// @brief Delete every cached segment.
+    void Clear();
+    SegmentCacheStats GetStats() const;
+
+private:
+    struct CacheEntry
+    {
+        uint64_t bytes;
+        std::list<std::string>::iterator lru_it;
+    };
+
+    /// @brief Delete the least recently used segments until within budget. Requires the lock.
+    void Evict();
+
+    const std::filesystem::path m_dir;
+    const uint64_t m_max_bytes;
+    mutable std::mutex m_mutex;
+    std::list<std::string> m_lru; // File names, most recent first
+    std::unordered_map<std::string, CacheEntry> m_cache;
+    uint64_t m_bytes = 0;
+    uint64_t m_hits = 0, m_misses = 0, m_evictions = 0;
+};
+
+}
\ No newline at end of file
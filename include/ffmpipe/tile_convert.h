@@ -0,0 +1,76 @@
+#pragma once
+#include <ffmpipe/frame.h>
+#include <vector>
+#include <functional>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief Converts a stream of packed RGB frames to I420, reconverting only the tiles that changed.
+ *
+ * Suited to desktop capture, where most of each frame repeats the previous one.
+ * Changes are either given as dirty rectangles, such as those reported by DXGI desktop duplication,
+ * or detected by comparing each tile against a copy of the previous source frame.
+ * The output frame persists between calls, so unchanged tiles cost nothing but the comparison.
+ *
+ * Not thread-safe.
+ */
+class TileConverter
+{
+public:
+    /**
+     * @param src_format A packed format.
+     * @param tile_size Width and height of a tile in pixels. Rounded up to a multiple of 16.
+     */
+    TileConverter(uint32_t width, uint32_t height, PixelFormat src_format, uint32_t tile_size = 64);
+    TileConverter(const TileConverter&) = delete;
+
+    /**
+     * @brief Detect the tiles that differ from the previous frame and convert them.
+     * @details The first frame, and the first after Reset, is converted whole.
+     * @param src Tightly packed source frame.
+     * @return The I420 output frame. See GetOutputSize.
+     */
+    const uint8_t* Convert(const void* src);
+    /**
+     * @brief Convert only the given rectangles, trusting that the rest of the frame is unchanged.
+     * @details The first frame, and the first after Reset, is converted whole.
+     * @param src Tightly packed source frame.
+     * @return The I420 output frame. See GetOutputSize.
+     */
+    const uint8_t* Convert(const void* src, const FrameRect* dirty_rects, size_t rect_count);
+    /// @brief Convert the next frame whole.
+    void Reset() { m_has_previous = false; }
+    /// @brief Split each frame's rows of tiles between the pool's threads. May be `nullptr`.
+    void SetWorkerPool(WorkerPool* pool) { m_pool = pool; }
+
+    const uint8_t* GetOutput() const { return m_output.data(); }
+    size_t GetOutputSize() const { return m_output.size(); }
+    /// @brief Number of tiles converted by the last call.
+    size_t GetDirtyTileCount() const { return m_dirty_tiles; }
+    size_t GetTileCount() const { return (size_t)m_tiles_x * m_tiles_y; }
+
+private:
+    /// @brief Convert all of `src` and keep a copy for detecting changes.
+    void ConvertAll(const uint8_t* src);
+    /// @brief Convert a tile and copy it to the previous frame.
+    void ConvertTile(const uint8_t* src, uint32_t tile_x, uint32_t tile_y);
+    /// @brief Call `fn` for each row of tiles, on the pool if there is one, and count the dirty tiles it returns.
+    void ForEachTileRow(const std::function<size_t(uint32_t tile_y)>& fn);
+
+    const uint32_t m_width, m_height, m_tile_size;
+    const PixelFormat m_format;
+    const uint32_t m_bytes_per_pixel;
+    const uint32_t m_tiles_x, m_tiles_y;
+
+    std::vector<uint8_t> m_previous;
+    std::vector<uint8_t> m_output;
+    /// @brief Marks tiles covered by dirty rectangles, so overlapping rectangles convert each tile once
+    std::vector<uint8_t> m_tile_marks;
+    bool m_has_previous = false;
+    size_t m_dirty_tiles = 0;
+    WorkerPool* m_pool = nullptr;
+};
+
+}
\ No newline at end of file
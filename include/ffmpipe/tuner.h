@@ -0,0 +1,108 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <ffmpipe/segment.h>
+#include <vector>
+#include <mutex>
+
+namespace ffmpipe
+{
+
+/// @brief Parameters for Tuner
+struct TunerOptions
+{
+    /// @brief Path of the FFmpeg executable.
+    std::filesystem::path ffmpeg_path;
+    /// @brief Arguments describing the input frames, excluding `-i -`.
+    /// @details Example: `-f rawvideo -pix_fmt rgb24 -s:v 1280x720 -framerate 60`
+    std::wstring input_args;
+    /// @brief Size of one frame in bytes.
+    size_t frame_size = 0;
+    /// @brief Number of frames in the trial clip.
+    uint64_t frame_count = 0;
+    /// @brief Frame rate of the clip, for computing bitrates.
+    double framerate = 60;
+    /// @brief Trial encodes run at once.
+    /// @details Concurrent trials compete for CPU, which lowers their fps. CPU time is unaffected.
+    uint32_t max_concurrent = 2;
+    /// @brief Compare each encode against the source with FFmpeg's `ssim` filter.
+    /// @details Candidates must then keep the frame size. The source is read a second time for each trial.
+    bool measure_quality = false;
+    /// @brief Directory for the trial outputs, which are deleted afterwards.
+    std::filesystem::path work_dir;
+    /// @brief File for caching results per content class. Empty to disable caching.
+    /// @details Results are also keyed by the FFmpeg executable, `input_args`, `frame_size`, and `frame_count`.
+    std::filesystem::path cache_path;
+    PipeOptions pipe_options;
+};
+
+/// @brief Measurements of one trial encode
+struct TrialResult
+{
+    /// @brief The candidate's output arguments.
+    std::wstring output_args;
+    bool ok = false;
+    /// @brief Whether the result came from the cache.
+    bool cached = false;
+    /// @brief Frames per second over the whole trial, including process startup.
+    double fps = 0;
+    /// @brief User and kernel CPU time of FFmpeg.
+    double cpu_seconds = 0;
+    uint64_t output_bytes = 0;
+    double bitrate_kbps = 0;
+    /// @brief SSIM of all planes from 0 to 1, or -1 if not measured.
+    double ssim = -1;
+};
+
+/**
+ * @brief Finds encoder settings that trade speed, size, and quality well, by encoding a short clip with each.
+ *
+ * Each candidate is a set of output arguments, such as `-c:v libx264 -preset veryfast -crf 23`.
+ * Trials run concurrently through separate Pipes. Results are cached per content class,
+ * such as "screen" or "game", so repeated tuning of similar content reuses them.
+ */
+class Tuner
+{
+public:
+    explicit Tuner(TunerOptions options);
+
+    /**
+     * @brief Measure every candidate that has no cached result for the content class. Blocking.
+     * @param content_class A name for the kind of content in the clip. Must not contain tabs or line breaks.
+     * @param source Produces each frame of the clip. Called concurrently from several threads.
+     * @return One result per candidate, in order.
+     */
+    std::vector<TrialResult> Run(
+        std::string_view content_class, const std::vector<std::wstring>& candidates, const FrameSource& source
+    );
+    /**
+     * @brief Keep the results that no other result beats in every way.
+     * @details A result is dominated by one that is at least as fast, small, and good (if measured),
+     * and better in one of them. Failed results are dropped. Sorted by fps, fastest first.
+     */
+    static std::vector<TrialResult> ParetoSet(const std::vector<TrialResult>& results);
+    /// @brief Set the callback for printing FFmpeg's stdout.
+    void SetPrintFunc(Pipe::PrintFunc fn) { m_print_fn = fn; }
+
+private:
+    TrialResult RunTrial(const std::wstring& output_args, uint64_t trial, const FrameSource& source);
+    /// @brief Run the `ssim` filter on an encoded trial. Returns -1 on failure.
+    double MeasureSsim(const std::filesystem::path& encoded, const FrameSource& source, uint8_t* buffer);
+    /// @brief Hash of everything besides the content class and output arguments that a result depends on.
+    std::string SetupKey() const;
+    void LoadCache();
+    bool SaveCache();
+
+    TunerOptions m_options;
+    Pipe::PrintFunc m_print_fn = nullptr;
+    std::mutex m_cache_mutex;
+    bool m_cache_loaded = false;
+    struct CacheEntry
+    {
+        std::string content_class;
+        std::string setup;
+        TrialResult result;
+    };
+    std::vector<CacheEntry> m_cache;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+#include <ffmpipe/ffmpipe.h>
+#include <vector>
+#include <mutex>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief Detect pipes whose FFmpeg stopped making progress.
+ * 
+ * A hung FFmpeg may keep accepting a few bytes at a time, so Pipe::Write never times out.
+ * The watchdog checks each pipe's frame counter and bytes written from a single background thread.
+ * Progress is a new frame count, or at least a quarter of the stdin buffer written since the last progress.
+ * A pipe is stalled when a Write or Close has been waiting without progress for the stall period.
+ * Each check also calls Pipe::PollLatency, so latency samples don't wait for the producer's next Write.
+ * 
+ * Methods are thread-safe.
+ */
+class Watchdog
+{
+public:
+    /// @brief Called from the watchdog thread when a pipe stalls.
+    using StallFunc = std::function<void(const PipePtr& pipe)>;
+
+    /**
+     * @param stall_ms Time in milliseconds without progress before a pipe is stalled.
+     * @param terminate If true, stalled pipes are terminated after calling `on_stall`.
+     * @param on_stall The callback for stalled pipes. May be `nullptr`.
+     */
+    Watchdog(DWORD stall_ms, bool terminate = true, StallFunc on_stall = nullptr);
+    ~Watchdog();
+    Watchdog(const Watchdog&) = delete;
+
+    /// @brief Start watching a pipe. It is forgotten once the pipe is destroyed.
+    void Watch(const PipePtr& pipe);
+    /// @brief Stop watching a pipe.
+    void Unwatch(const PipePtr& pipe);
+    /// @brief Number of stalls detected so far.
+    uint64_t GetStallCount() const { return m_stall_count; }
+
+private:
+    struct Entry
+    {
+        std::weak_ptr<Pipe> pipe;
+        uint64_t bytes_written = 0;
+        uint64_t frames = 0;
+        ULONGLONG last_progress_ms = 0;
+        bool stalled = false;
+    };
+
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    void Check();
+
+    DWORD m_stall_ms;
+    bool m_terminate;
+    StallFunc m_on_stall;
+
+    std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    std::atomic<uint64_t> m_stall_count = 0;
+
+    HANDLE m_stop_event = NULL;
+    HANDLE m_thread = NULL;
+};
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief Threads that split the rows of one frame between them, so a single frame is processed by several cores.
+ *
+ * ForEachBand hands out bands of rows from one atomic counter. The calling thread works too,
+ * and waits once for the last band, so a frame costs one wake-up and one wait.
+ * The threads stay on one NUMA node, by default the caller's, so they work on memory that is local to them.
+ * Create one pool per node that holds frames.
+ *
+ * Pass the pool to the frame kernels. Their output is identical to the serial path, because bands
+ * cover whole rows, or whole pairs of rows for I420, and each output byte is computed by one band.
+ *
+ * ForEachBand may be called from several threads, such as pipes sharing a pool. Their jobs run one at a time.
+ * Don't call it from inside a band.
+ */
+class WorkerPool
+{
+public:
+    /// @brief Process the rows `[first_row, end_row)`.
+    using BandFunc = std::function<void(uint32_t first_row, uint32_t end_row)>;
+
+    /**
+     * @param thread_count Threads besides the caller, or 0 for one less than the node's processors.
+     * @param numa_node The node to run on, or -1 for the node of the calling thread.
+     */
+    explicit WorkerPool(uint32_t thread_count = 0, int numa_node = -1);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+
+    /**
+     * @brief Run `fn` over the rows `[0, rows)` in bands, and wait for all bands. Blocking.
+     * @param align Every band but the last starts and ends on a multiple of this many rows.
+     */
+    void ForEachBand(uint32_t rows, uint32_t align, const BandFunc& fn);
+    /// @brief Number of threads besides the caller.
+    uint32_t GetThreadCount() const { return (uint32_t)m_threads.size(); }
+
+private:
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    /// @brief Claim and process bands until none are left.
+    void Work();
+
+    std::vector<HANDLE> m_threads;
+    HANDLE m_wake_semaphore = NULL;
+    HANDLE m_done_event = NULL;
+    std::atomic<bool> m_stop = false;
+    /// @brief Held by ForEachBand for a whole job, so concurrent callers queue instead of overwriting it
+    std::mutex m_job_mutex;
+
+    /// @brief The band count in the high half and the next band in the low half.
+    /// @details A claim is a compare-exchange, so it only succeeds on the current job.
+    std::atomic<uint64_t> m_bands = 0;
+    std::atomic<uint32_t> m_remaining = 0;
+    /// @brief The current job. Written before `m_bands` is published.
+    const BandFunc* m_fn = nullptr;
+    uint32_t m_rows = 0, m_align = 1, m_units = 0;
+};
+
+}
\ No newline at end of file
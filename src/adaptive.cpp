@@ -0,0 +1,254 @@
+#include <ffmpipe/adaptive.h>
+#include "clock.h"
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+namespace ffmpipe
+{
+
+std::string ResolutionSwitch::ToString() const
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    ss << "frame " << frame << " (" << time_s << "s): ";
+    ss << from_width << 'x' << from_height << " -> " << width << 'x' << height;
+    ss << " after " << previous_duration_s << "s, switch took " << std::setprecision(0) << switch_ms << " ms";
+    ss << " (" << reason << ')';
+    return ss.str();
+}
+
+AdaptiveEncoder::AdaptiveEncoder(AdaptiveOptions options)
+    : m_options(std::move(options)), m_bytes_per_pixel(BytesPerPixel(m_options.format))
+{
+    // Levels are powers of 2, and each keeps at least 2x2 pixels after rounding to even
+    uint32_t max_factor = 1;
+    while (max_factor * 2 <= m_options.max_factor && LevelSize(m_options.width, max_factor * 2) >= 2
+        && LevelSize(m_options.height, max_factor * 2) >= 2)
+        max_factor *= 2;
+    m_options.max_factor = max_factor;
+    m_options.degrade_windows = m_options.degrade_windows ? m_options.degrade_windows : 1;
+    m_options.restore_windows = m_options.restore_windows ? m_options.restore_windows : 1;
+    m_restore_windows = m_options.restore_windows;
+}
+
+AdaptiveEncoder::~AdaptiveEncoder()
+{
+    Close();
+}
+
+std::shared_ptr<AdaptiveEncoder> AdaptiveEncoder::Create(AdaptiveOptions options)
+{
+    if (!options.width || !options.height || !BytesPerPixel(options.format) || !options.output_args)
+        return nullptr;
+
+    std::shared_ptr<AdaptiveEncoder> encoder(new AdaptiveEncoder(std::move(options)));
+    encoder->m_pipe = encoder->Start();
+    if (!encoder->m_pipe)
+        return nullptr;
+    encoder->m_profiler = std::make_unique<StallProfiler>(encoder->m_pipe, encoder->m_options.window_ms, 1);
+    encoder->m_start_qpc = encoder->m_level_start_qpc = QpcNow();
+    return encoder;
+}
+
+PipePtr AdaptiveEncoder::Start()
+{
+    const uint32_t width = GetWidth(), height = GetHeight();
+    std::wstringstream args;
+    args << L"-f rawvideo -pix_fmt " << PixelFormatName(m_options.format) << L" -s:v " << width << L'x' << height;
+    args << L" -framerate " << m_options.framerate << L" -i - ";
+    args << m_options.output_args(m_process_index, width, height);
+
+    PipePtr pipe = Pipe::Create(m_options.ffmpeg_path, args.str(), m_options.pipe_options);
+    if (!pipe)
+        return nullptr;
+    pipe->SetPrintFunc(m_print_fn);
+    ++m_process_index;
+    return pipe;
+}
+
+void AdaptiveEncoder::SetPrintFunc(Pipe::PrintFunc fn)
+{
+    m_print_fn = fn;
+    if (m_pipe)
+        m_pipe->SetPrintFunc(fn);
+}
+
+const void* AdaptiveEncoder::Scale(const void* frame, size_t& size)
+{
+    size = FrameSize(m_options.format, GetWidth(), GetHeight());
+    if (m_factor == 1)
+        return frame;
+
+    Downscale((const uint8_t*)frame, m_options.width, m_options.height, m_bytes_per_pixel, m_factor, m_scaled.data());
+    const size_t scaled_stride = (size_t)(m_options.width / m_factor) * m_bytes_per_pixel;
+    const size_t stride = (size_t)GetWidth() * m_bytes_per_pixel;
+    if (stride != scaled_stride)
+    {
+        // Drop the odd last column. Rows only move towards the start, so each move is safe in place.
+        for (uint32_t y = 1; y < GetHeight(); ++y)
+            memmove(m_scaled.data() + y * stride, m_scaled.data() + y * scaled_stride, stride);
+    }
+    // An odd last row is left out by the size
+    return m_scaled.data();
+}
+
+bool AdaptiveEncoder::Write(const void* frame)
+{
+    if (!m_pipe)
+        return false;
+
+    if (!m_next_factor || !Switch(frame))
+    {
+        size_t size = 0;
+        const void* data = Scale(frame, size);
+        if (!m_pipe->Write(data, size))
+            return false;
+    }
+    ++m_frame_index;
+
+    m_profiler->Sample();
+    Evaluate();
+    return true;
+}
+
+void AdaptiveEncoder::Evaluate()
+{
+    const uint64_t window_count = m_profiler->GetWindowCount();
+    if (window_count == m_windows_seen)
+        return;
+    m_windows_seen = window_count;
+
+    // The first window of a process includes its startup, which says nothing about the encoder
+    if (++m_level_windows == 1)
+        return;
+    const StallBreakdown window = m_profiler->GetLastWindow();
+    if (window.wall_s <= 0)
+        return;
+
+    const double wait_share = (window.encoder_bound_s + window.pipe_blocked_s) / window.wall_s;
+    m_pressure_windows = wait_share >= m_options.degrade_wait_share ? m_pressure_windows + 1 : 0;
+    m_headroom_windows = wait_share <= m_options.restore_wait_share ? m_headroom_windows + 1 : 0;
+
+    if (m_pressure_windows >= m_options.degrade_windows && m_factor < m_options.max_factor)
+    {
+        // A restore that is undone before it lasted as long as it took to earn means the encoder is at its limit
+        if (m_level_restored && m_level_windows <= m_restore_windows)
+        {
+            const uint32_t limit = m_options.restore_windows * 8;
+            m_restore_windows = m_restore_windows * 2 < limit ? m_restore_windows * 2 : limit;
+        }
+        else
+            m_restore_windows = m_options.restore_windows;
+        m_next_factor = m_factor * 2;
+    }
+    else if (m_headroom_windows >= m_restore_windows && m_factor > 1)
+        m_next_factor = m_factor / 2;
+    else
+        return;
+
+    m_pressure_windows = 0;
+    m_headroom_windows = 0;
+    m_next_reason = window.Verdict();
+}
+
+bool AdaptiveEncoder::Confirm(const PipePtr& pipe)
+{
+    const int64_t start_qpc = QpcNow();
+    while (pipe->GetQueuedBytes() > 0 && pipe->GetExitCode() == STILL_ACTIVE)
+    {
+        if (QpcToMicroseconds(QpcNow() - start_qpc) > (int64_t)m_options.pipe_options.timeout_ms * 1000)
+            return false;
+        Sleep(1);
+    }
+
+    // FFmpeg initializes its encoder on the first frame, and exits shortly after if that fails
+    const int64_t read_qpc = QpcNow();
+    while (QpcToMicroseconds(QpcNow() - read_qpc) < (int64_t)m_options.confirm_ms * 1000)
+    {
+        if (pipe->GetExitCode() != STILL_ACTIVE)
+            return false;
+        Sleep(1);
+    }
+    return pipe->GetExitCode() == STILL_ACTIVE;
+}
+
+bool AdaptiveEncoder::Switch(const void* frame)
+{
+    const int64_t switch_start_qpc = QpcNow();
+    const uint32_t previous_factor = m_factor;
+    const uint32_t previous_width = GetWidth(), previous_height = GetHeight();
+    const uint32_t factor = m_next_factor;
+    m_next_factor = 0;
+
+    // Downscale writes whole blocks before Scale crops to even dimensions
+    auto set_factor = [this](uint32_t factor) {
+        m_factor = factor;
+        m_scaled.resize(factor > 1 ? FrameSize(m_options.format, m_options.width / factor, m_options.height / factor) : 0);
+    };
+    set_factor(factor);
+    PipePtr pipe = Start();
+    size_t size = 0;
+    const void* data = pipe ? Scale(frame, size) : nullptr;
+    if (!pipe || !pipe->Write(data, size) || !Confirm(pipe))
+    {
+        // Keep encoding at the current resolution with the previous process, and try again after another run of windows
+        if (pipe)
+        {
+            pipe->SetPrintFunc(nullptr);
+            pipe->Close(0);
+        }
+        set_factor(previous_factor);
+        return false;
+    }
+    const int64_t now_qpc = QpcNow();
+
+    ResolutionSwitch record;
+    record.frame = m_frame_index;
+    record.time_s = QpcToMicroseconds(now_qpc - m_start_qpc) / 1e6;
+    record.from_factor = previous_factor;
+    record.to_factor = factor;
+    record.from_width = previous_width;
+    record.from_height = previous_height;
+    record.width = GetWidth();
+    record.height = GetHeight();
+    record.previous_duration_s = QpcToMicroseconds(now_qpc - m_level_start_qpc) / 1e6;
+    record.switch_ms = QpcToMicroseconds(now_qpc - switch_start_qpc) / 1e3;
+    record.reason = m_next_reason;
+    m_switches.push_back(record);
+    if (m_switch_fn)
+        m_switch_fn(record);
+    else
+        Pipe::DefaultPrintFunc("ffmpipe: resolution " + record.ToString() + "\n");
+
+    Retire(std::move(m_pipe));
+    m_pipe = std::move(pipe);
+    m_profiler = std::make_unique<StallProfiler>(m_pipe, m_options.window_ms, 1);
+    m_windows_seen = 0;
+    m_level_windows = 0;
+    m_level_restored = factor < previous_factor;
+    m_level_start_qpc = now_qpc;
+    return true;
+}
+
+void AdaptiveEncoder::Retire(PipePtr pipe)
+{
+    // Switches are several windows apart, so the previous process has usually finished
+    if (m_retire_thread.joinable())
+        m_retire_thread.join();
+    const DWORD timeout_ms = m_options.pipe_options.timeout_ms;
+    m_retire_thread = std::thread([pipe = std::move(pipe), timeout_ms] { pipe->Close(timeout_ms); });
+}
+
+void AdaptiveEncoder::Close()
+{
+    if (m_pipe)
+    {
+        m_pipe->Close(m_options.pipe_options.timeout_ms);
+        m_pipe = nullptr;
+    }
+    if (m_retire_thread.joinable())
+        m_retire_thread.join();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include <ffmpipe/audio.h>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define FFMPIPE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace ffmpipe
+{
+
+uint32_t BytesPerSample(SampleFormat format)
+{
+    switch (format)
+    {
+    case SampleFormat::S16: return 2;
+    case SampleFormat::F32: return 4;
+    }
+    return 0;
+}
+
+const char* SampleFormatName(SampleFormat format)
+{
+    switch (format)
+    {
+    case SampleFormat::S16: return "s16le";
+    case SampleFormat::F32: return "f32le";
+    }
+    return "";
+}
+
+void ConvertToS16(const float* src, size_t count, int16_t* dst)
+{
+    size_t i = 0;
+#ifdef FFMPIPE_SSE2
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 low = _mm_set1_ps(-1.0f), high = _mm_set1_ps(1.0f);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), low), high);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), low), high);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)), _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+        _mm_storeu_si128((__m128i*)(dst + i), packed);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        // Rounds half to even, like the SSE conversion
+        const float sample = std::clamp(src[i], -1.0f, 1.0f);
+        dst[i] = (int16_t)std::nearbyint(sample * 32767.0f);
+    }
+}
+
+DriftEstimator::DriftEstimator(
+    uint32_t sample_rate, double max_correction, double rate_window_seconds, double settle_seconds
+) : m_sample_rate(sample_rate), m_max_correction(max_correction),
+    m_rate_window_seconds(rate_window_seconds), m_settle_seconds(settle_seconds)
+{
+    Reset();
+}
+
+void DriftEstimator::Reset()
+{
+    m_started = false;
+    m_rate = m_sample_rate;
+    m_ratio = 1;
+    m_offset_seconds = 0;
+    m_weight = 0;
+    m_mean_clock = 0;
+    m_mean_captured = 0;
+    m_covariance = 0;
+    m_variance = 0;
+}
+
+void DriftEstimator::Update(uint64_t captured_frames, double clock_seconds, uint64_t output_frames)
+{
+    if (!m_started)
+    {
+        m_started = true;
+        m_first_captured = captured_frames;
+        m_first_output = output_frames;
+        m_first_clock = clock_seconds;
+        m_last_clock = clock_seconds;
+    }
+    if (clock_seconds < m_last_clock)
+        return;
+
+    // Exponentially weighted linear regression of frames captured against the clock.
+    // Buffer timing jitters by milliseconds, but the slope over minutes is precise to a few ppm.
+    const double decay = std::exp(-(clock_seconds - m_last_clock) / m_rate_window_seconds);
+    const double t = clock_seconds - m_first_clock;
+    const double s = (double)(captured_frames - m_first_captured);
+    m_weight = m_weight * decay + 1;
+    const double dt = t - m_mean_clock;
+    m_mean_clock += dt / m_weight;
+    m_mean_captured += (s - m_mean_captured) / m_weight;
+    m_variance = m_variance * decay + dt * (t - m_mean_clock);
+    m_covariance = m_covariance * decay + dt * (s - m_mean_captured);
+    m_last_clock = clock_seconds;
+
+    // Wait for a second of data before trusting the slope
+    if (m_variance > 0 && t >= 1)
+        m_rate = m_covariance / m_variance;
+
+    const double written = (double)(output_frames - m_first_output);
+    m_offset_seconds = written / m_sample_rate - t;
+
+    // Follow the measured rate, and steer the accumulated offset back to zero
+    const double ratio = m_sample_rate / m_rate * (1 - m_offset_seconds / m_settle_seconds);
+    m_ratio = std::clamp(ratio, 1 - m_max_correction, 1 + m_max_correction);
+}
+
+static double BesselI0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; ++k)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+Resampler::Resampler(uint32_t channels, uint32_t taps, uint32_t phases)
+    : m_channels(channels ? channels : 1), m_taps(taps < 4 ? 4 : (taps + 3) / 4 * 4), m_phases(phases ? phases : 1)
+{
+    // Kaiser-windowed sinc, passing 90% of the band. Each phase is normalized to unity gain.
+    const double CUTOFF = 0.9;
+    const double BETA = 8;
+    const double PI = 3.14159265358979323846;
+    const double center = m_taps / 2 - 1;
+    const double half_width = m_taps / 2;
+
+    m_coefficients.resize((size_t)(m_phases + 1) * m_taps);
+    for (uint32_t phase = 0; phase <= m_phases; ++phase)
+    {
+        float* row = m_coefficients.data() + (size_t)phase * m_taps;
+        double sum = 0;
+        for (uint32_t k = 0; k < m_taps; ++k)
+        {
+            const double t = k - center - (double)phase / m_phases;
+            const double x = t / half_width;
+            const double window = std::abs(x) < 1 ? BesselI0(BETA * std::sqrt(1 - x * x)) / BesselI0(BETA) : 0;
+            const double sinc = t == 0 ? 1 : std::sin(PI * CUTOFF * t) / (PI * CUTOFF * t);
+            row[k] = (float)(CUTOFF * sinc * window);
+            sum += row[k];
+        }
+        for (uint32_t k = 0; k < m_taps; ++k)
+            row[k] = (float)(row[k] / sum);
+    }
+
+    // Start with silence, so the first output frame has a full filter behind it
+    m_history.resize(m_channels, std::vector<float>(m_taps - 1, 0.0f));
+}
+
+static inline float Dot(const float* a, const float* b, uint32_t count)
+{
+#ifdef FFMPIPE_SSE2
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    if (i < count)
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+#else
+    float sum = 0;
+    for (uint32_t i = 0; i < count; ++i)
+        sum += a[i] * b[i];
+    return sum;
+#endif
+}
+
+size_t Resampler::Process(const float* in, size_t frames, std::vector<float>& out)
+{
+    for (uint32_t channel = 0; channel < m_channels; ++channel)
+    {
+        std::vector<float>& history = m_history[channel];
+        const size_t start = history.size();
+        history.resize(start + frames);
+        for (size_t i = 0; i < frames; ++i)
+            history[start + i] = in[i * m_channels + channel];
+    }
+    m_input_frames += frames;
+
+    const size_t available = m_history[0].size();
+    size_t produced = 0;
+    for (;;)
+    {
+        const size_t index = (size_t)m_position;
+        if (index + m_taps > available)
+            break;
+
+        const double phase = (m_position - index) * m_phases;
+        const uint32_t phase_index = (uint32_t)phase;
+        const float blend = (float)(phase - phase_index);
+        const float* c0 = m_coefficients.data() + (size_t)phase_index * m_taps;
+        const float* c1 = c0 + m_taps;
+
+        for (uint32_t channel = 0; channel < m_channels; ++channel)
+        {
+            const float* window = m_history[channel].data() + index;
+            const float a = Dot(window, c0, m_taps);
+            const float b = Dot(window, c1, m_taps);
+            out.push_back(a + blend * (b - a));
+        }
+        ++produced;
+        m_position += m_step;
+    }
+
+    // Drop the input that no future output frame reaches
+    const size_t consumed = (size_t)m_position < available ? (size_t)m_position : available;
+    for (std::vector<float>& history : m_history)
+        history.erase(history.begin(), history.begin() + consumed);
+    m_position -= consumed;
+
+    m_output_frames += produced;
+    return produced;
+}
+
+/// @brief `dst[i] = src[i] * gain`, or `dst[i] += src[i] * gain` if `accumulate`
+static void MixSamples(const float* src, size_t count, float gain, bool accumulate, float* dst)
+{
+    size_t i = 0;
+#ifdef FFMPIPE_SSE2
+    const __m128 g = _mm_set1_ps(gain);
+    if (accumulate)
+    {
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+    }
+    else
+    {
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = accumulate ? dst[i] + src[i] * gain : src[i] * gain;
+}
+
+Mixer::Mixer(uint32_t channels, SampleFormat output_format)
+    : m_channels(channels ? channels : 1), m_output_format(output_format)
+{}
+
+size_t Mixer::AddTrack(float gain)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tracks.emplace_back();
+    m_tracks.back().gain = gain;
+    return m_tracks.size() - 1;
+}
+
+void Mixer::SetGain(size_t track, float gain)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (track < m_tracks.size())
+        m_tracks[track].gain = gain;
+}
+
+void Mixer::Submit(size_t track, const float* samples, size_t frames)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (track >= m_tracks.size())
+        return;
+    Track& t = m_tracks[track];
+
+    // Reclaim mixed samples once they are most of the queue, so the queue doesn't grow
+    if (t.read > 0 && t.read >= t.samples.size() / 2)
+    {
+        t.samples.erase(t.samples.begin(), t.samples.begin() + t.read);
+        t.read = 0;
+    }
+    t.samples.insert(t.samples.end(), samples, samples + frames * m_channels);
+}
+
+size_t Mixer::Mix(std::vector<uint8_t>& out, bool pad_silence)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_tracks.empty())
+        return 0;
+
+    size_t frames = pad_silence ? 0 : SIZE_MAX;
+    for (const Track& track : m_tracks)
+    {
+        const size_t queued = (track.samples.size() - track.read) / m_channels;
+        frames = pad_silence ? (queued > frames ? queued : frames) : (queued < frames ? queued : frames);
+    }
+    if (frames == 0)
+        return 0;
+
+    const size_t count = frames * m_channels;
+    m_mix.resize(count);
+    // Each track covers a prefix of the mix, so the first track to reach a sample stores instead of adding
+    size_t covered = 0;
+    for (Track& track : m_tracks)
+    {
+        const size_t available = track.samples.size() - track.read;
+        const size_t n = available < count ? available : count;
+        const float* src = track.samples.data() + track.read;
+        const size_t overlap = n < covered ? n : covered;
+        MixSamples(src, overlap, track.gain, true, m_mix.data());
+        MixSamples(src + overlap, n - overlap, track.gain, false, m_mix.data() + overlap);
+        if (n > covered)
+            covered = n;
+        track.read += n;
+    }
+    memset(m_mix.data() + covered, 0, (count - covered) * sizeof(float));
+
+    const size_t start = out.size();
+    out.resize(start + count * BytesPerSample(m_output_format));
+    if (m_output_format == SampleFormat::S16)
+        ConvertToS16(m_mix.data(), count, (int16_t*)(out.data() + start));
+    else
+        memcpy(out.data() + start, m_mix.data(), count * sizeof(float));
+    return frames;
+}
+
+size_t Mixer::GetQueuedFrames(size_t track) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (track >= m_tracks.size())
+        return 0;
+    return (m_tracks[track].samples.size() - m_tracks[track].read) / m_channels;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+namespace ffmpipe
+{
+
+/// @brief The current performance counter value
+inline int64_t QpcNow()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+/// @brief Convert a performance counter duration to microseconds
+inline int64_t QpcToMicroseconds(int64_t qpc)
+{
+    static const int64_t frequency = [] {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        return frequency.QuadPart;
+    }();
+    return qpc / frequency * 1'000'000 + qpc % frequency * 1'000'000 / frequency;
+}
+
+}
@@ -1,25 +1,41 @@
 #include <ffmpipe/ffmpipe.h>
+#include "clock.h"
+#include "trace.h"
 #include <sstream>
 #include <iostream>
 #include <array>
+#include <cctype>
+#include <cwctype>
+#include <cstdlib>
+#include <psapi.h>
 
 namespace ffmpipe
 {
 
+/// @brief How often Write checks FFmpeg's progress while it is too far behind in the growing file
+static const DWORD GROWING_FILE_POLL_MS = 10;
+/// @brief How often Close drains FFmpeg's console output while waiting for it to exit
+static const DWORD CLOSE_POLL_MS = 50;
+
 /**
  * @brief Create the read & write pipes for redirecting stdin/stdout/stderr
  * @details The handle pointers are assigned when the function returns true
- * @param out_read_pipe Receives a named, synchronous pipe for reading
+ * @param out_read_pipe Receives a named pipe for reading. It is synchronous unless `overlapped_read` is true.
  * @param out_write_pipe Receives an async (overlapped) file for writing
- * @param buffer_size Size of the internal buffer for `out_write_pipe`
+ * @param buffer_size Size of the kernel buffer for data flowing from `out_write_pipe` to `out_read_pipe`
  * @param timeout_ms Timeout in milliseconds for the read pipe
+ * @param child_reads Whether the child gets the read end. Only the child's end is inheritable, from the start,
+ * so a process spawned meanwhile by another thread can't inherit our end and hold the pipe open.
+ * @param overlapped_read Open the read pipe for async (overlapped) reads
  */
-static bool CreatePipePair(const char* name, HANDLE* out_read_pipe, HANDLE* out_write_pipe, DWORD buffer_size, DWORD timeout_ms)
+static bool CreatePipePair(const char* name, HANDLE* out_read_pipe, HANDLE* out_write_pipe, DWORD buffer_size, DWORD timeout_ms, bool child_reads, bool overlapped_read = false)
 {
-    SECURITY_ATTRIBUTES security_attrs;
-    security_attrs.nLength = sizeof(SECURITY_ATTRIBUTES);
-    security_attrs.bInheritHandle = TRUE;
-    security_attrs.lpSecurityDescriptor = NULL;
+    SECURITY_ATTRIBUTES read_attrs;
+    read_attrs.nLength = sizeof(SECURITY_ATTRIBUTES);
+    read_attrs.bInheritHandle = child_reads;
+    read_attrs.lpSecurityDescriptor = NULL;
+    SECURITY_ATTRIBUTES write_attrs = read_attrs;
+    write_attrs.bInheritHandle = !child_reads;
 
     std::string full_name;
     {
@@ -30,11 +46,11 @@ static bool CreatePipePair(const char* name, HANDLE* out_read_pipe, HANDLE* out_
 
     HANDLE read_pipe = CreateNamedPipeA(
         full_name.c_str(),
-        PIPE_ACCESS_INBOUND,
+        PIPE_ACCESS_INBOUND | (overlapped_read ? FILE_FLAG_OVERLAPPED : 0),
         PIPE_TYPE_BYTE | PIPE_WAIT,
         1,
-        buffer_size, buffer_size,
-        timeout_ms, &security_attrs
+        0, buffer_size, // Inbound only, so no output buffer is needed
+        timeout_ms, &read_attrs
     );
     if (read_pipe == INVALID_HANDLE_VALUE)
         return false;
@@ -43,7 +59,7 @@ static bool CreatePipePair(const char* name, HANDLE* out_read_pipe, HANDLE* out_
         full_name.c_str(),
         GENERIC_WRITE,
         0, // No sharing
-        &security_attrs,
+        &write_attrs,
         OPEN_EXISTING,
         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
         NULL // Template file
@@ -59,9 +75,87 @@ static bool CreatePipePair(const char* name, HANDLE* out_read_pipe, HANDLE* out_
     return true;
 }
 
+std::wstring_view LowLatencyInputArgs() {
+    return L"-probesize 32 -analyzeduration 0 -fflags nobuffer -flags low_delay";
+}
+
+std::wstring QuoteArg(std::wstring_view arg)
+{
+    // Backslashes are literal, unless they precede a quote
+    std::wstring quoted = L"\"";
+    size_t backslashes = 0;
+    for (wchar_t ch : arg)
+    {
+        if (ch == L'\\')
+        {
+            ++backslashes;
+            continue;
+        }
+        if (ch == L'"')
+            backslashes = backslashes * 2 + 1;
+        quoted.append(backslashes, L'\\');
+        quoted.push_back(ch);
+        backslashes = 0;
+    }
+    quoted.append(backslashes * 2, L'\\');
+    quoted.push_back(L'"');
+    return quoted;
+}
+
+std::wstring ExecutableIdentity(const std::filesystem::path& path)
+{
+    std::error_code error;
+    const uint64_t size = std::filesystem::file_size(path, error);
+    if (error)
+        return std::wstring();
+    const std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+    if (error)
+        return std::wstring();
+    std::wstringstream identity;
+    identity << std::filesystem::absolute(path, error).wstring() << L'|' << size << L'|' << time.time_since_epoch().count();
+    return identity.str();
+}
+
+/**
+ * @brief Replace the `-i -` input with a growing file, read in follow mode.
+ * @return `false` if the arguments have no `-i -`.
+ */
+static bool FollowGrowingFile(std::wstring& args, const std::filesystem::path& path, DWORD timeout_ms, uint64_t skip_bytes)
+{
+    size_t pos = 0;
+    for (;; pos += 4)
+    {
+        pos = args.find(L"-i -", pos);
+        if (pos == std::wstring::npos)
+            return false;
+        // Match whole arguments only, not `-i -foo` or `-vsync-i -`
+        bool starts = pos == 0 || iswspace(args[pos - 1]);
+        bool ends = pos + 4 == args.size() || iswspace(args[pos + 4]);
+        if (starts && ends)
+            break;
+    }
+
+    std::wstringstream input;
+    // FFmpeg would otherwise poll its stdin for commands. rw_timeout is in microseconds.
+    input << L"-nostdin -follow 1 -rw_timeout " << (uint64_t)timeout_ms * 1000 << L' ';
+    if (skip_bytes)
+        input << L"-skip_initial_bytes " << skip_bytes << L' ';
+    input << L"-i " << QuoteArg(L"file:" + path.wstring());
+    args.replace(pos, 4, input.str());
+    return true;
+}
+
 Pipe::~Pipe()
 {
-    std::array<HANDLE, 4> invalid_handles = { m_stdin_r, m_stdin_w, m_stdout_r, m_stdout_w };
+    // Give a running FFmpeg the same chance to finish as Close, rather than leaving it behind.
+    // The print callback may refer to objects that are already destroyed, so the last output is dropped.
+    if (m_procinfo.hProcess && GetExitCode() == STILL_ACTIVE)
+    {
+        m_print_fn = nullptr;
+        Close(m_timeout_ms, true);
+    }
+
+    std::array<HANDLE, 5> invalid_handles = { m_stdin_r, m_stdin_w, m_stdout_r, m_stdout_w, m_data_r };
     std::array<HANDLE, 3> null_handles = { m_event, m_procinfo.hProcess, m_procinfo.hThread };
 
     for (HANDLE handle : null_handles)
@@ -75,14 +169,60 @@ Pipe::~Pipe()
         if (handle != INVALID_HANDLE_VALUE)
             CloseHandle(handle);
     }
+
+    if (!m_growing_file.empty())
+        DeleteFileW(m_growing_file.wstring().c_str());
+}
+
+PipeOptions PipeOptions::Compact(size_t frame_size)
+{
+    const size_t page_size = 4096;
+    // The kernel rounds buffer sizes to whole pages anyway
+    size_t stdin_size = (frame_size + page_size - 1) / page_size * page_size;
+    if (stdin_size < page_size)
+        stdin_size = page_size;
+
+    PipeOptions options;
+    options.stdin_buffer_size = (DWORD)stdin_size;
+    options.stdout_buffer_size = (DWORD)page_size;
+    return options;
+}
+
+PipeOptions PipeOptions::LowLatency(size_t frame_size)
+{
+    PipeOptions options = Compact(frame_size);
+    options.measure_latency = true;
+    return options;
 }
 
 std::shared_ptr<Pipe> Pipe::Create(
     const std::filesystem::path& ffmpeg_path, std::wstring_view ffmpeg_args,
     DWORD timeout_ms
 ) {
+    PipeOptions options;
+    options.timeout_ms = timeout_ms;
+    return Create(ffmpeg_path, ffmpeg_args, options);
+}
+
+std::shared_ptr<Pipe> Pipe::Create(
+    const std::filesystem::path& ffmpeg_path, std::wstring_view ffmpeg_args,
+    const PipeOptions& options
+) {
+    static std::atomic<uint64_t> next_id = 1;
+    const int64_t create_start_qpc = QpcNow();
+    const DWORD timeout_ms = options.timeout_ms;
     std::shared_ptr<Pipe> stream = std::shared_ptr<Pipe>(new Pipe);
+    stream->m_id = next_id++;
     stream->m_timeout_ms = timeout_ms;
+    stream->m_stdin_buffer_size = options.stdin_buffer_size;
+    stream->m_stdout_buffer_size = options.stdout_buffer_size;
+    stream->m_read_buffer_size = options.read_stdout ? options.read_buffer_size : 0;
+    stream->m_measure_latency = options.measure_latency && options.growing_file.empty();
+    stream->m_ffmpeg_path = ffmpeg_path;
+    stream->m_ffmpeg_args = ffmpeg_args;
+    stream->m_retain_bytes = options.growing_file_retain_bytes;
+    stream->m_frame_size = options.growing_file_frame_size;
+    stream->m_follow_timeout_ms = options.growing_file_timeout_ms;
 
     stream->m_event = CreateEventA(nullptr, FALSE, FALSE, nullptr);
     if (!stream->m_event)
@@ -90,33 +230,92 @@ std::shared_ptr<Pipe> Pipe::Create(
 
     // Create pipes to redirect stdout, stderr, and stdin
 
-    if (!CreatePipePair("stdout", &stream->m_stdout_r, &stream->m_stdout_w, 4096 * 4096, timeout_ms)
-        || !SetHandleInformation(stream->m_stdout_r, HANDLE_FLAG_INHERIT, 0)
-    ) {
+    if (!CreatePipePair("stdout", &stream->m_stdout_r, &stream->m_stdout_w, options.stdout_buffer_size, timeout_ms, false))
         return nullptr;
+
+    if (options.growing_file.empty())
+    {
+        if (!CreatePipePair("stdin", &stream->m_stdin_r, &stream->m_stdin_w, options.stdin_buffer_size, timeout_ms, true))
+            return nullptr;
     }
+    else
+    {
+        // FFmpeg opens the file by name, so it must share reading. The handle itself is not inherited.
+        stream->m_stdin_w = CreateFileW(
+            options.growing_file.wstring().c_str(),
+            GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_DELETE,
+            nullptr,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_OVERLAPPED,
+            NULL
+        );
+        if (stream->m_stdin_w == INVALID_HANDLE_VALUE)
+            return nullptr;
+        stream->m_growing_file = options.growing_file;
+        stream->m_stdin_buffer_size = 0;
 
-    if (!CreatePipePair("stdin", &stream->m_stdin_r, &stream->m_stdin_w, 4096 * 4096, timeout_ms)
-        || !SetHandleInformation(stream->m_stdin_w, HANDLE_FLAG_INHERIT, 0)
-    ) {
-        return nullptr;
+        // Sparse, so deallocated ranges cost no space. Without it, the file only grows.
+        OVERLAPPED overlapped = {0};
+        overlapped.hEvent = stream->m_event;
+        DWORD returned = 0;
+        if (!DeviceIoControl(stream->m_stdin_w, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, nullptr, &overlapped))
+        {
+            if (GetLastError() == ERROR_IO_PENDING)
+                GetOverlappedResult(stream->m_stdin_w, &overlapped, &returned, TRUE);
+        }
     }
 
+    HANDLE data_w = INVALID_HANDLE_VALUE;
+    if (options.read_stdout && !CreatePipePair("data", &stream->m_data_r, &data_w, options.read_buffer_size, timeout_ms, false, true))
+        return nullptr;
+    const int64_t pipes_end_qpc = QpcNow();
+
     // Create the child process
 
+    bool created = stream->Spawn(0, options.read_stdout ? data_w : stream->m_stdout_w);
+
+    // Only the child may hold the data pipe's write end, so reads see the end of output when it exits
+    if (data_w != INVALID_HANDLE_VALUE)
+        CloseHandle(data_w);
+    if (!created)
+        return nullptr;
+
+    stream->m_create_start_qpc = create_start_qpc;
+    stream->m_pipes_us = QpcToMicroseconds(pipes_end_qpc - create_start_qpc);
+    stream->m_spawn_us = QpcToMicroseconds(QpcNow() - pipes_end_qpc);
+    FFMPIPE_TRACE("Spawn",
+        TraceLoggingUInt64(stream->m_id, "pipe"),
+        TraceLoggingUInt32(stream->m_procinfo.dwProcessId, "pid"),
+        TraceLoggingInt64(stream->m_pipes_us, "pipes_us"),
+        TraceLoggingInt64(stream->m_spawn_us, "spawn_us")
+    );
+    return stream;
+}
+
+bool Pipe::Spawn(uint64_t skip_bytes, HANDLE stdout_handle)
+{
+    std::wstring args = m_ffmpeg_args;
+    if (!m_growing_file.empty() && !FollowGrowingFile(args, m_growing_file, m_follow_timeout_ms, skip_bytes))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return false;
+    }
+
     STARTUPINFOW startup_info;
     memset(&startup_info, 0, sizeof(startup_info));
     startup_info.cb = sizeof(startup_info);
-    startup_info.hStdError = stream->m_stdout_w;
-    startup_info.hStdOutput = stream->m_stdout_w;
-    startup_info.hStdInput = stream->m_stdin_r;
+    startup_info.hStdError = m_stdout_w;
+    startup_info.hStdOutput = stdout_handle;
+    startup_info.hStdInput = m_stdin_r != INVALID_HANDLE_VALUE ? m_stdin_r : NULL;
     startup_info.dwFlags = STARTF_USESTDHANDLES;
 
-    std::wstring cmdline = ffmpeg_path.wstring();
+    std::wstring cmdline = m_ffmpeg_path.wstring();
     cmdline += ' ';
-    cmdline += ffmpeg_args;
+    cmdline += args;
 
-    if (!CreateProcessW(
+    PROCESS_INFORMATION procinfo = {0};
+    BOOL created = CreateProcessW(
         NULL,               // application name
         cmdline.data(),     // command line 
         NULL,               // process security attributes 
@@ -126,12 +325,127 @@ std::shared_ptr<Pipe> Pipe::Create(
         NULL,               // use parent's environment 
         NULL,               // use parent's current directory 
         &startup_info,      // STARTUPINFO pointer 
-        &stream->m_procinfo // receives PROCESS_INFORMATION 
-    )) {
-        return nullptr;
+        &procinfo           // receives PROCESS_INFORMATION 
+    );
+    if (!created)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_process_mutex);
+    m_procinfo = procinfo;
+    return true;
+}
+
+bool Pipe::Restart(uint64_t offset, std::wstring_view ffmpeg_args)
+{
+    if (m_growing_file.empty() || m_data_r != INVALID_HANDLE_VALUE || m_stdin_w == INVALID_HANDLE_VALUE
+        || offset < m_released_bytes || offset > m_bytes_written
+    ) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return false;
     }
 
-    return stream;
+    if (GetExitCode() == STILL_ACTIVE)
+    {
+        TerminateProcess(m_procinfo.hProcess, -1);
+        WaitForSingleObject(m_procinfo.hProcess, m_timeout_ms);
+    }
+    ReadOutput();
+    // Terminate and GetProcessUsage may be using the handles on other threads
+    PROCESS_INFORMATION old_procinfo;
+    {
+        std::lock_guard<std::mutex> lock(m_process_mutex);
+        old_procinfo = m_procinfo;
+        m_procinfo = {0};
+    }
+    CloseHandle(old_procinfo.hProcess);
+    CloseHandle(old_procinfo.hThread);
+
+    if (!ffmpeg_args.empty())
+        m_ffmpeg_args = ffmpeg_args;
+    m_output_line.clear();
+    // The new process counts its frames from the offset
+    m_frames = 0;
+    m_spawn_offset = offset;
+
+    const int64_t spawn_start_qpc = QpcNow();
+    if (!Spawn(offset, m_stdout_w))
+        return false;
+    m_create_start_qpc = spawn_start_qpc;
+    m_pipes_us = 0;
+    m_spawn_us = QpcToMicroseconds(QpcNow() - spawn_start_qpc);
+    m_first_read_seen_us = m_first_output_us = m_first_progress_us = 0;
+    FFMPIPE_TRACE("Spawn",
+        TraceLoggingUInt64(m_id, "pipe"),
+        TraceLoggingUInt32(m_procinfo.dwProcessId, "pid"),
+        TraceLoggingInt64(m_spawn_us, "spawn_us")
+    );
+    return true;
+}
+
+void Pipe::ReleaseGrowingFile()
+{
+    // Deallocate in large steps, so the file system is asked rarely
+    const uint64_t step = 64 * 1024 * 1024;
+    const uint64_t written = m_bytes_written;
+    if (!m_frame_size || written < m_retain_bytes)
+        return;
+    // FFmpeg may still read anything it has not reported as encoded
+    const uint64_t encoded = EncodedBytes();
+    const uint64_t target = written - m_retain_bytes < encoded ? written - m_retain_bytes : encoded;
+    if (target < m_released_bytes + step)
+        return;
+    const uint64_t end = target / step * step;
+
+    FILE_ZERO_DATA_INFORMATION range;
+    range.FileOffset.QuadPart = (LONGLONG)m_released_bytes;
+    range.BeyondFinalZero.QuadPart = (LONGLONG)end;
+    OVERLAPPED overlapped = {0};
+    overlapped.hEvent = m_event;
+    DWORD returned = 0;
+    bool ok = DeviceIoControl(m_stdin_w, FSCTL_SET_ZERO_DATA, &range, sizeof(range), nullptr, 0, nullptr, &overlapped);
+    if (!ok && GetLastError() == ERROR_IO_PENDING)
+        ok = GetOverlappedResult(m_stdin_w, &overlapped, &returned, TRUE);
+    if (ok)
+        m_released_bytes = end;
+    SetLastError(ERROR_SUCCESS);
+}
+
+uint64_t Pipe::GetRestartOffset() const
+{
+    const uint64_t released = m_released_bytes;
+    return m_frame_size ? (released + m_frame_size - 1) / m_frame_size * m_frame_size : released;
+}
+
+bool Pipe::WaitForGrowingFile(size_t length)
+{
+    if (!m_frame_size || m_bytes_written + length <= EncodedBytes() + m_retain_bytes)
+        return true;
+
+    // Progress is only seen in FFmpeg's output, so it is polled
+    const int64_t wait_start_qpc = QpcNow();
+    m_wait_start_qpc = wait_start_qpc;
+    FFMPIPE_TRACE("WaitStart", TraceLoggingUInt64(m_id, "pipe"));
+    bool ok = true;
+    while (m_bytes_written + length > EncodedBytes() + m_retain_bytes)
+    {
+        if (QpcToMicroseconds(QpcNow() - wait_start_qpc) > (int64_t)m_timeout_ms * 1000)
+        {
+            SetLastError(ERROR_TIMEOUT);
+            ok = false;
+            break;
+        }
+        Sleep(GROWING_FILE_POLL_MS);
+        ReadOutput();
+    }
+    const int64_t wait_qpc = QpcNow() - wait_start_qpc;
+    m_wait_qpc += wait_qpc;
+    m_wait_start_qpc = 0;
+    FFMPIPE_TRACE("WaitEnd",
+        TraceLoggingUInt64(m_id, "pipe"),
+        TraceLoggingInt64(QpcToMicroseconds(wait_qpc), "wait_us"),
+        TraceLoggingUInt32(ok ? STATUS_WAIT_0 : WAIT_TIMEOUT, "result")
+    );
+    return ok;
 }
 
 bool Pipe::Write(const void* data, size_t length)
@@ -139,40 +453,333 @@ bool Pipe::Write(const void* data, size_t length)
     DWORD total_written = 0;
     OVERLAPPED overlapped = {0};
     overlapped.hEvent = m_event;
+    m_busy = true;
+    const int64_t write_start_qpc = QpcNow();
+    m_write_start_qpc = write_start_qpc;
+    FFMPIPE_TRACE("WriteStart", TraceLoggingUInt64(m_id, "pipe"), TraceLoggingUInt64(length, "bytes"));
+    int64_t submit_qpc = 0;
+    if (m_measure_latency)
+    {
+        PollLatency();
+        submit_qpc = QpcNow();
+    }
 
-    while (total_written < length)
+    // Deallocated data must stay behind what FFmpeg has encoded
+    const bool can_write = m_growing_file.empty() || WaitForGrowingFile(length);
+    while (can_write && total_written < length)
     {
+        // Files are written at the offset, and pipes ignore it
+        const uint64_t offset = m_bytes_written;
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
         bool ok = WriteFile(m_stdin_w, (const uint8_t*)data + total_written, (DWORD)length - total_written, nullptr, &overlapped);
         if (!ok)
         {
             if (GetLastError() != ERROR_IO_PENDING)
-                return false;
+                break;
             SetLastError(ERROR_SUCCESS);
         }
         
+        // A growing file keeps accepting data while FFmpeg is down, so only a pipe fails when it exits
         HANDLE wait_objects[2] = { m_event, m_procinfo.hProcess };
-        if (WaitForMultipleObjects(2, wait_objects, FALSE, m_timeout_ms) != STATUS_WAIT_0)
-            return false; // Failure or timeout
+        const DWORD wait_count = m_growing_file.empty() ? 2 : 1;
+        const int64_t wait_start_qpc = QpcNow();
+        m_wait_start_qpc = wait_start_qpc;
+        FFMPIPE_TRACE("WaitStart", TraceLoggingUInt64(m_id, "pipe"));
+        DWORD wait_result = WaitForMultipleObjects(wait_count, wait_objects, FALSE, m_timeout_ms);
+        const int64_t wait_qpc = QpcNow() - wait_start_qpc;
+        m_wait_qpc += wait_qpc;
+        m_wait_start_qpc = 0;
+        FFMPIPE_TRACE("WaitEnd",
+            TraceLoggingUInt64(m_id, "pipe"),
+            TraceLoggingInt64(QpcToMicroseconds(wait_qpc), "wait_us"),
+            TraceLoggingUInt32(wait_result, "result")
+        );
+
+        if (wait_result != STATUS_WAIT_0)
+        {
+            // Failure or timeout. The write must not outlive `overlapped`.
+            DWORD error = GetLastError();
+            DWORD written = 0;
+            CancelIoEx(m_stdin_w, &overlapped);
+            GetOverlappedResult(m_stdin_w, &overlapped, &written, TRUE);
+            m_bytes_written += written;
+            SetLastError(error);
+            break;
+        }
         
         DWORD written = 0;
         if (!GetOverlappedResult(m_stdin_w, &overlapped, &written, FALSE))
-            return false;
+            break;
         
         total_written += written;
+        m_bytes_written += written;
         
         ReadOutput();
     }
-    return true;
+
+    if (!m_growing_file.empty())
+        ReleaseGrowingFile();
+
+    if (m_measure_latency)
+    {
+        if (total_written == length)
+        {
+            std::lock_guard<std::mutex> lock(m_latency_mutex);
+            m_pending_writes.push_back(PendingWrite { m_bytes_written, submit_qpc });
+        }
+        PollLatency();
+    }
+
+    const int64_t write_qpc = QpcNow() - write_start_qpc;
+    m_write_qpc += write_qpc;
+    m_write_start_qpc = 0;
+    FFMPIPE_TRACE("WriteEnd",
+        TraceLoggingUInt64(m_id, "pipe"),
+        TraceLoggingUInt64(total_written, "bytes"),
+        TraceLoggingInt64(QpcToMicroseconds(write_qpc), "write_us"),
+        TraceLoggingBoolean(total_written == length, "ok")
+    );
+    m_busy = false;
+    return total_written == length;
+}
+
+bool Pipe::Read(void* data, size_t length, size_t* out_read)
+{
+    // Console output is drained while waiting, so FFmpeg never blocks on a full stderr
+    const DWORD poll_ms = 50;
+
+    size_t total_read = 0;
+    OVERLAPPED overlapped = {0};
+    overlapped.hEvent = m_event;
+    m_busy = true;
+
+    while (total_read < length)
+    {
+        DWORD read = 0;
+        size_t remaining = length - total_read;
+        DWORD request = remaining > MAXDWORD ? MAXDWORD : (DWORD)remaining;
+        if (!ReadFile(m_data_r, (uint8_t*)data + total_read, request, nullptr, &overlapped))
+        {
+            if (GetLastError() != ERROR_IO_PENDING)
+                break; // ERROR_BROKEN_PIPE at the end of output
+            SetLastError(ERROR_SUCCESS);
+        }
+
+        DWORD waited_ms = 0;
+        DWORD result;
+        while ((result = WaitForSingleObject(m_event, poll_ms)) == WAIT_TIMEOUT && waited_ms < m_timeout_ms)
+        {
+            waited_ms += poll_ms;
+            ReadOutput();
+        }
+        if (result != WAIT_OBJECT_0)
+        {
+            DWORD error = result == WAIT_TIMEOUT ? ERROR_TIMEOUT : GetLastError();
+            CancelIoEx(m_data_r, &overlapped);
+            GetOverlappedResult(m_data_r, &overlapped, &read, TRUE);
+            total_read += read;
+            SetLastError(error);
+            break;
+        }
+
+        if (!GetOverlappedResult(m_data_r, &overlapped, &read, FALSE))
+            break;
+        total_read += read;
+    }
+
+    DWORD error = GetLastError();
+    ReadOutput();
+    SetLastError(error);
+    m_busy = false;
+    if (out_read)
+        *out_read = total_read;
+    return total_read == length;
+}
+
+bool Pipe::ReadAll(std::string& out)
+{
+    char buffer[64 * 1024];
+    size_t read = 0;
+    while (Read(buffer, sizeof(buffer), &read))
+        out.append(buffer, read);
+    out.append(buffer, read);
+    return GetLastError() == ERROR_BROKEN_PIPE;
 }
 
 void Pipe::Close(DWORD timeout_ms, bool terminate)
 {
+    m_busy = true;
+    [[maybe_unused]] const int64_t close_start_qpc = QpcNow();
     CloseHandle(m_stdin_w);
     m_stdin_w = INVALID_HANDLE_VALUE;
-    DWORD result = WaitForSingleObject(m_procinfo.hProcess, timeout_ms);
+
+    // FFmpeg prints its summary while finishing, which would fill a small stdout buffer and stall it
+    DWORD waited_ms = 0;
+    DWORD result;
+    for (;;)
+    {
+        DWORD wait_ms = timeout_ms - waited_ms < CLOSE_POLL_MS ? timeout_ms - waited_ms : CLOSE_POLL_MS;
+        result = WaitForSingleObject(m_procinfo.hProcess, wait_ms);
+        if (result != WAIT_TIMEOUT)
+            break;
+        ReadOutput();
+        if (timeout_ms == INFINITE)
+            continue;
+        waited_ms += wait_ms;
+        if (waited_ms >= timeout_ms)
+            break;
+    }
     if (result != STATUS_WAIT_0 && terminate)
         TerminateProcess(m_procinfo.hProcess, -1);
     ReadOutput();
+    FFMPIPE_TRACE("Exit",
+        TraceLoggingUInt64(m_id, "pipe"),
+        TraceLoggingUInt32(GetExitCode(), "exit_code"),
+        TraceLoggingInt64(QpcToMicroseconds(QpcNow() - close_start_qpc), "close_us")
+    );
+    m_busy = false;
+}
+
+PipeStats Pipe::GetStats() const
+{
+    PipeStats stats;
+    stats.bytes_written = m_bytes_written;
+    stats.frames = m_frames;
+    stats.fps = m_fps;
+    stats.speed = m_speed;
+    stats.dropped_frames = m_dropped_frames;
+    stats.busy = m_busy;
+    stats.queued_bytes = GetQueuedBytes();
+    stats.stdin_buffer_size = m_stdin_buffer_size;
+
+    // Include the Write or wait in progress, so a long block is not reported all at once when it ends
+    int64_t now_qpc = QpcNow();
+    int64_t write_start_qpc = m_write_start_qpc, wait_start_qpc = m_wait_start_qpc;
+    int64_t write_qpc = m_write_qpc + (write_start_qpc ? now_qpc - write_start_qpc : 0);
+    int64_t wait_qpc = m_wait_qpc + (wait_start_qpc ? now_qpc - wait_start_qpc : 0);
+    stats.write_us = (uint64_t)QpcToMicroseconds(write_qpc);
+    stats.wait_us = (uint64_t)QpcToMicroseconds(wait_qpc);
+
+    stats.latency_last_us = m_latency_last_us;
+    stats.latency_max_us = m_latency_max_us;
+    stats.latency_total_us = m_latency_total_us;
+    stats.latency_samples = m_latency_samples;
+
+    stats.startup.pipes_us = m_pipes_us;
+    stats.startup.spawn_us = m_spawn_us;
+    stats.startup.first_read_seen_us = m_first_read_seen_us;
+    stats.startup.first_output_us = m_first_output_us;
+    stats.startup.first_progress_us = m_first_progress_us;
+    return stats;
+}
+
+DWORD Pipe::GetExitCode() const
+{
+    DWORD code = STILL_ACTIVE;
+    GetExitCodeProcess(m_procinfo.hProcess, &code);
+    return code;
+}
+
+size_t Pipe::GetQueuedBytes() const
+{
+    DWORD available = 0;
+    if (!PeekNamedPipe(m_stdin_r, nullptr, 0, nullptr, &available, nullptr))
+        return 0;
+    return available;
+}
+
+PipeProcessUsage Pipe::GetProcessUsage() const
+{
+    PipeProcessUsage usage;
+    std::lock_guard<std::mutex> lock(m_process_mutex);
+
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (GetProcessTimes(m_procinfo.hProcess, &creation_time, &exit_time, &kernel_time, &user_time))
+    {
+        ULARGE_INTEGER kernel, user;
+        kernel.LowPart = kernel_time.dwLowDateTime;
+        kernel.HighPart = kernel_time.dwHighDateTime;
+        user.LowPart = user_time.dwLowDateTime;
+        user.HighPart = user_time.dwHighDateTime;
+        usage.cpu_seconds = (kernel.QuadPart + user.QuadPart) / 1e7; // 100-nanosecond units
+    }
+
+    PROCESS_MEMORY_COUNTERS memory = {0};
+    memory.cb = sizeof(memory);
+    if (GetProcessMemoryInfo(m_procinfo.hProcess, &memory, sizeof(memory)))
+        usage.resident_bytes = memory.WorkingSetSize;
+    
+    return usage;
+}
+
+void Pipe::PollLatency()
+{
+    if (!m_measure_latency)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_latency_mutex);
+    // The queue also holds data of a write still in flight, which m_bytes_written doesn't count yet.
+    // Reading the count first keeps `consumed` an underestimate, so no frame is counted as read early.
+    const uint64_t written = m_bytes_written;
+    const uint64_t queued = GetQueuedBytes();
+    if (queued > written)
+        return;
+    // A frame has been read once everything after it is all that remains in the pipe
+    uint64_t consumed = written - queued;
+    int64_t now_qpc = QpcNow();
+
+    while (!m_pending_writes.empty() && m_pending_writes.front().end_offset <= consumed)
+    {
+        uint64_t latency_us = (uint64_t)QpcToMicroseconds(now_qpc - m_pending_writes.front().submit_qpc);
+        m_pending_writes.pop_front();
+
+        m_latency_last_us = latency_us;
+        m_latency_total_us += latency_us;
+        ++m_latency_samples;
+        if (latency_us > m_latency_max_us)
+            m_latency_max_us = latency_us;
+    }
+}
+
+uint64_t Pipe::StartupMicroseconds() const
+{
+    const int64_t us = QpcToMicroseconds(QpcNow() - m_create_start_qpc);
+    return us > 0 ? (uint64_t)us : 1;
+}
+
+void Pipe::UpdateFirstRead()
+{
+    // The growing file is read by name, so reads can't be seen
+    if (m_first_read_seen_us || !m_growing_file.empty() || m_bytes_written <= GetQueuedBytes())
+        return;
+    m_first_read_seen_us = StartupMicroseconds();
+    FFMPIPE_TRACE("FirstReadSeen",
+        TraceLoggingUInt64(m_id, "pipe"), TraceLoggingUInt64(m_first_read_seen_us, "first_read_seen_us")
+    );
+}
+
+void Pipe::Terminate()
+{
+    std::lock_guard<std::mutex> lock(m_process_mutex);
+    if (m_procinfo.hProcess)
+        TerminateProcess(m_procinfo.hProcess, -1);
+}
+
+PipeMemoryUsage Pipe::GetMemoryUsage() const
+{
+    PipeMemoryUsage usage;
+    usage.object_bytes = sizeof(Pipe);
+    usage.kernel_buffer_bytes = (size_t)m_stdin_buffer_size + m_stdout_buffer_size + m_read_buffer_size;
+
+    std::array<HANDLE, 5> invalid_handles = { m_stdin_r, m_stdin_w, m_stdout_r, m_stdout_w, m_data_r };
+    std::array<HANDLE, 3> null_handles = { m_event, m_procinfo.hProcess, m_procinfo.hThread };
+    for (HANDLE handle : invalid_handles)
+        usage.handle_count += handle != INVALID_HANDLE_VALUE;
+    for (HANDLE handle : null_handles)
+        usage.handle_count += handle != NULL;
+    
+    return usage;
 }
 
 void Pipe::DefaultPrintFunc(std::string_view str) {
@@ -181,6 +788,8 @@ void Pipe::DefaultPrintFunc(std::string_view str) {
 
 size_t Pipe::ReadOutput()
 {
+    UpdateFirstRead();
+
     DWORD available;
     if (!PeekNamedPipe(m_stdout_r, nullptr, 0, nullptr, &available, nullptr))
         return 0;
@@ -198,6 +807,15 @@ size_t Pipe::ReadOutput()
             return total_read;
         
         total_read += read;
+        FFMPIPE_TRACE("OutputRead", TraceLoggingUInt64(m_id, "pipe"), TraceLoggingUInt32(read, "bytes"));
+        if (!m_first_output_us && read)
+        {
+            m_first_output_us = StartupMicroseconds();
+            FFMPIPE_TRACE("FirstOutput",
+                TraceLoggingUInt64(m_id, "pipe"), TraceLoggingUInt64(m_first_output_us, "first_output_us")
+            );
+        }
+        ParseOutput(std::string_view(buffer, read));
         if (m_print_fn)
             m_print_fn(std::string_view(buffer, read));
     }
@@ -205,4 +823,63 @@ size_t Pipe::ReadOutput()
     return total_read;
 }
 
+void Pipe::ParseOutput(std::string_view str)
+{
+    // Status lines end with '\r' on a terminal, and progress lines (-progress pipe:1) end with '\n'
+    const size_t max_line = 512;
+
+    for (char ch : str)
+    {
+        if (ch == '\r' || ch == '\n')
+        {
+            ParseProgressLine(m_output_line);
+            m_output_line.clear();
+        }
+        else if (m_output_line.size() < max_line)
+            m_output_line.push_back(ch);
+    }
+}
+
+void Pipe::ParseProgressLine(std::string_view line)
+{
+    size_t pos = 0;
+    while ((pos = line.find('=', pos)) != std::string_view::npos)
+    {
+        size_t key_begin = pos;
+        while (key_begin > 0 && (isalnum((unsigned char)line[key_begin - 1]) || line[key_begin - 1] == '_'))
+            --key_begin;
+        std::string_view key = line.substr(key_begin, pos - key_begin);
+
+        size_t value_begin = line.find_first_not_of(' ', pos + 1);
+        if (value_begin == std::string_view::npos)
+            break;
+        size_t value_end = line.find_first_of(" \t", value_begin);
+        if (value_end == std::string_view::npos)
+            value_end = line.size();
+        std::string value(line.substr(value_begin, value_end - value_begin));
+        pos = value_end;
+
+        if (value.empty() || !(isdigit((unsigned char)value[0]) || value[0] == '.'))
+            continue; // "N/A" and other placeholders
+
+        if (key == "frame")
+        {
+            m_frames = strtoull(value.c_str(), nullptr, 10);
+            if (!m_first_progress_us)
+            {
+                m_first_progress_us = StartupMicroseconds();
+                FFMPIPE_TRACE("FirstProgress",
+                    TraceLoggingUInt64(m_id, "pipe"), TraceLoggingUInt64(m_first_progress_us, "first_progress_us")
+                );
+            }
+        }
+        else if (key == "fps")
+            m_fps = strtof(value.c_str(), nullptr);
+        else if (key == "speed")
+            m_speed = strtof(value.c_str(), nullptr); // The trailing 'x' is ignored
+        else if (key == "drop" || key == "drop_frames")
+            m_dropped_frames = strtoull(value.c_str(), nullptr, 10);
+    }
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,427 @@
+#include <ffmpipe/frame.h>
+#include <ffmpipe/worker_pool.h>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define FFMPIPE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace ffmpipe
+{
+
+uint32_t BytesPerPixel(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::RGB24:
+    case PixelFormat::BGR24:
+        return 3;
+    case PixelFormat::RGBA:
+    case PixelFormat::BGRA:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+size_t FrameSize(PixelFormat format, uint32_t width, uint32_t height)
+{
+    if (format == PixelFormat::I420)
+    {
+        size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+        return (size_t)width * height + chroma * 2;
+    }
+    return (size_t)width * height * BytesPerPixel(format);
+}
+
+const char* PixelFormatName(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::RGB24: return "rgb24";
+    case PixelFormat::BGR24: return "bgr24";
+    case PixelFormat::RGBA: return "rgba";
+    case PixelFormat::BGRA: return "bgra";
+    case PixelFormat::I420: return "yuv420p";
+    }
+    return "";
+}
+
+/// @brief Average 2x2 blocks of 4-byte pixels. Rounds the same as the generic path.
+static void Downscale2x4(const uint8_t* row0, const uint8_t* row1, uint32_t dst_width, uint8_t* dst)
+{
+    uint32_t x = 0;
+#ifdef FFMPIPE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    for (; x + 2 <= dst_width; x += 2)
+    {
+        // 4 source pixels per row become 2 output pixels
+        __m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+        __m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i sum = _mm_unpacklo_epi64(lo, hi);
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        _mm_storel_epi64((__m128i*)(dst + x * 4), _mm_packus_epi16(sum, zero));
+    }
+#endif
+    for (; x < dst_width; ++x)
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            uint32_t sum = row0[x * 8 + i] + row0[x * 8 + 4 + i] + row1[x * 8 + i] + row1[x * 8 + 4 + i];
+            dst[x * 4 + i] = (uint8_t)((sum + 2) >> 2);
+        }
+    }
+}
+
+/// @brief Sum `rows` rows of `count` bytes into 16-bit column sums. `rows` must be at most 257.
+static void SumColumns(const uint8_t* src, size_t src_stride, uint32_t rows, size_t count, uint16_t* sums)
+{
+    size_t i = 0;
+#ifdef FFMPIPE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lo = zero, hi = zero;
+        for (uint32_t y = 0; y < rows; ++y)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + y * src_stride + i));
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+        _mm_storeu_si128((__m128i*)(sums + i), lo);
+        _mm_storeu_si128((__m128i*)(sums + i + 8), hi);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        uint32_t sum = 0;
+        for (uint32_t y = 0; y < rows; ++y)
+            sum += src[y * src_stride + i];
+        sums[i] = (uint16_t)sum;
+    }
+}
+
+/// @brief Downscale the output rows [y0, y1). See Downscale.
+static void DownscaleRows(
+    const uint8_t* src, uint32_t src_width, uint32_t bytes_per_pixel, uint32_t factor, uint8_t* dst,
+    uint32_t y0, uint32_t y1
+) {
+    const uint32_t dst_width = src_width / factor;
+    const size_t src_stride = (size_t)src_width * bytes_per_pixel;
+    const size_t dst_stride = (size_t)dst_width * bytes_per_pixel;
+    const uint32_t area = factor * factor;
+    // Other sizes sum each block's columns with SIMD first, which also works for 3-byte pixels
+    std::vector<uint16_t> sums(factor <= 257 ? (size_t)dst_width * factor * bytes_per_pixel : 0);
+
+    for (uint32_t y = y0; y < y1; ++y)
+    {
+        const uint8_t* src_row = src + (size_t)y * factor * src_stride;
+        uint8_t* dst_row = dst + y * dst_stride;
+
+        if (factor == 2 && bytes_per_pixel == 4)
+        {
+            Downscale2x4(src_row, src_row + src_stride, dst_width, dst_row);
+            continue;
+        }
+        if (!sums.empty())
+        {
+            SumColumns(src_row, src_stride, factor, sums.size(), sums.data());
+            for (uint32_t x = 0; x < dst_width; ++x)
+            {
+                const uint16_t* block = sums.data() + (size_t)x * factor * bytes_per_pixel;
+                for (uint32_t i = 0; i < bytes_per_pixel; ++i)
+                {
+                    uint32_t sum = 0;
+                    for (uint32_t bx = 0; bx < factor; ++bx)
+                        sum += block[bx * bytes_per_pixel + i];
+                    dst_row[x * bytes_per_pixel + i] = (uint8_t)((sum + area / 2) / area);
+                }
+            }
+            continue;
+        }
+
+        for (uint32_t x = 0; x < dst_width; ++x)
+        {
+            for (uint32_t i = 0; i < bytes_per_pixel; ++i)
+            {
+                uint32_t sum = 0;
+                for (uint32_t by = 0; by < factor; ++by)
+                {
+                    const uint8_t* block = src_row + by * src_stride + ((size_t)x * factor) * bytes_per_pixel + i;
+                    for (uint32_t bx = 0; bx < factor; ++bx)
+                        sum += block[bx * bytes_per_pixel];
+                }
+                dst_row[x * bytes_per_pixel + i] = (uint8_t)((sum + area / 2) / area);
+            }
+        }
+    }
+}
+
+void Downscale(
+    const uint8_t* src, uint32_t src_width, uint32_t src_height, uint32_t bytes_per_pixel,
+    uint32_t factor, uint8_t* dst, WorkerPool* pool
+) {
+    const uint32_t dst_height = src_height / factor;
+    if (!pool)
+    {
+        DownscaleRows(src, src_width, bytes_per_pixel, factor, dst, 0, dst_height);
+        return;
+    }
+    pool->ForEachBand(dst_height, 1, [&](uint32_t first_row, uint32_t end_row) {
+        DownscaleRows(src, src_width, bytes_per_pixel, factor, dst, first_row, end_row);
+    });
+}
+
+/// @brief Byte offsets of red, green, and blue in a packed pixel
+struct RgbLayout
+{
+    uint32_t r, g, b, bytes_per_pixel;
+};
+
+static RgbLayout GetRgbLayout(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::RGB24: return { 0, 1, 2, 3 };
+    case PixelFormat::BGR24: return { 2, 1, 0, 3 };
+    case PixelFormat::RGBA: return { 0, 1, 2, 4 };
+    case PixelFormat::BGRA: return { 2, 1, 0, 4 };
+    default: return { 0, 0, 0, 0 };
+    }
+}
+
+static inline uint8_t RgbToY(int r, int g, int b) {
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t RgbToU(int r, int g, int b) {
+    return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t RgbToV(int r, int g, int b) {
+    return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+/**
+ * @brief Convert the rectangle [x0, x1) x [y0, y1) of a frame to I420.
+ * @details `x0` and `y0` must be even, so each 2x2 chroma block is converted whole.
+ */
+static void ConvertToI420Rect(
+    const uint8_t* src, const RgbLayout& layout, uint32_t width, uint32_t height, uint8_t* dst,
+    uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1
+) {
+    const size_t src_stride = (size_t)width * layout.bytes_per_pixel;
+    const uint32_t chroma_width = (width + 1) / 2;
+    uint8_t* dst_y = dst;
+    uint8_t* dst_u = dst_y + (size_t)width * height;
+    uint8_t* dst_v = dst_u + (size_t)chroma_width * ((height + 1) / 2);
+
+    for (uint32_t y = y0; y < y1; y += 2)
+    {
+        const uint32_t rows = y + 1 < y1 ? 2 : 1;
+        for (uint32_t x = x0; x < x1; x += 2)
+        {
+            const uint32_t cols = x + 1 < x1 ? 2 : 1;
+            int sum_r = 0, sum_g = 0, sum_b = 0;
+
+            for (uint32_t dy = 0; dy < rows; ++dy)
+            {
+                for (uint32_t dx = 0; dx < cols; ++dx)
+                {
+                    const uint8_t* pixel = src + (y + dy) * src_stride + (size_t)(x + dx) * layout.bytes_per_pixel;
+                    int r = pixel[layout.r], g = pixel[layout.g], b = pixel[layout.b];
+                    dst_y[(size_t)(y + dy) * width + x + dx] = RgbToY(r, g, b);
+                    sum_r += r;
+                    sum_g += g;
+                    sum_b += b;
+                }
+            }
+
+            const int count = (int)(rows * cols);
+            const size_t chroma_index = (size_t)(y / 2) * chroma_width + x / 2;
+            const int r = (sum_r + count / 2) / count, g = (sum_g + count / 2) / count, b = (sum_b + count / 2) / count;
+            dst_u[chroma_index] = RgbToU(r, g, b);
+            dst_v[chroma_index] = RgbToV(r, g, b);
+        }
+    }
+}
+
+/// @brief Convert a rectangle, splitting its rows between the pool's threads in pairs.
+static void ConvertToI420Rect(
+    const uint8_t* src, const RgbLayout& layout, uint32_t width, uint32_t height, uint8_t* dst,
+    uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, WorkerPool* pool
+) {
+    if (!pool)
+    {
+        ConvertToI420Rect(src, layout, width, height, dst, x0, y0, x1, y1);
+        return;
+    }
+    pool->ForEachBand(y1 - y0, 2, [&](uint32_t first_row, uint32_t end_row) {
+        ConvertToI420Rect(src, layout, width, height, dst, x0, y0 + first_row, x1, y0 + end_row);
+    });
+}
+
+void ConvertToI420(
+    const uint8_t* src, PixelFormat src_format, uint32_t width, uint32_t height, uint8_t* dst,
+    WorkerPool* pool
+) {
+    RgbLayout layout = GetRgbLayout(src_format);
+    if (layout.bytes_per_pixel == 0)
+        return;
+    ConvertToI420Rect(src, layout, width, height, dst, 0, 0, width, height, pool);
+}
+
+void ConvertToI420Rect(
+    const uint8_t* src, PixelFormat src_format, uint32_t width, uint32_t height, const FrameRect& rect, uint8_t* dst,
+    WorkerPool* pool
+) {
+    RgbLayout layout = GetRgbLayout(src_format);
+    if (layout.bytes_per_pixel == 0 || rect.x >= width || rect.y >= height)
+        return;
+
+    // An odd end would split a chroma block, so round it up unless it is the frame's edge
+    uint32_t x1 = rect.width > width - rect.x ? width : rect.x + rect.width;
+    uint32_t y1 = rect.height > height - rect.y ? height : rect.y + rect.height;
+    if (x1 % 2 && x1 < width)
+        ++x1;
+    if (y1 % 2 && y1 < height)
+        ++y1;
+    ConvertToI420Rect(src, layout, width, height, dst, rect.x & ~1u, rect.y & ~1u, x1, y1, pool);
+}
+
+void StreamCopy(void* dst, const void* src, size_t size, WorkerPool* pool)
+{
+    if (pool && size >= 2 * STREAM_COPY_MIN_SIZE)
+    {
+        // Each band is whole blocks, which each thread streams and fences itself
+        const size_t block = STREAM_COPY_MIN_SIZE;
+        pool->ForEachBand((uint32_t)((size - 1) / block + 1), 1, [&](uint32_t first_block, uint32_t end_block) {
+            const size_t offset = first_block * block;
+            const size_t end = end_block * block < size ? end_block * block : size;
+            StreamCopy((uint8_t*)dst + offset, (const uint8_t*)src + offset, end - offset);
+        });
+        return;
+    }
+#ifdef FFMPIPE_SSE2
+    if (size >= STREAM_COPY_MIN_SIZE)
+    {
+        uint8_t* out = (uint8_t*)dst;
+        const uint8_t* in = (const uint8_t*)src;
+
+        // Streaming stores need 16-byte alignment
+        const size_t head = (16 - ((uintptr_t)out & 15)) & 15;
+        memcpy(out, in, head);
+        out += head;
+        in += head;
+        size -= head;
+
+        const size_t PREFETCH_DISTANCE = 512;
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64)
+        {
+            _mm_prefetch((const char*)(in + i + PREFETCH_DISTANCE), _MM_HINT_NTA);
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*)(in + i + 32));
+            __m128i d = _mm_loadu_si128((const __m128i*)(in + i + 48));
+            _mm_stream_si128((__m128i*)(out + i), a);
+            _mm_stream_si128((__m128i*)(out + i + 16), b);
+            _mm_stream_si128((__m128i*)(out + i + 32), c);
+            _mm_stream_si128((__m128i*)(out + i + 48), d);
+        }
+        // Order the streaming stores before any later release of the buffer to another thread
+        _mm_sfence();
+        memcpy(out + i, in + i, size - i);
+        return;
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+static const uint64_t XXH_PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t XXH_PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t XXH_PRIME3 = 0x165667B19E3779F9ull;
+static const uint64_t XXH_PRIME4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t XXH_PRIME5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t Rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Read64(const uint8_t* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t Read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t XxhRound(uint64_t acc, uint64_t input) {
+    return Rotl64(acc + input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t XxhMerge(uint64_t acc, uint64_t value) {
+    return (acc ^ XxhRound(0, value)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + size;
+    uint64_t hash;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        uint64_t v2 = seed + XXH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = XxhRound(v1, Read64(p));
+            v2 = XxhRound(v2, Read64(p + 8));
+            v3 = XxhRound(v3, Read64(p + 16));
+            v4 = XxhRound(v4, Read64(p + 24));
+        }
+        hash = Rotl64(v1, 1) + Rotl64(v2, 7) + Rotl64(v3, 12) + Rotl64(v4, 18);
+        hash = XxhMerge(hash, v1);
+        hash = XxhMerge(hash, v2);
+        hash = XxhMerge(hash, v3);
+        hash = XxhMerge(hash, v4);
+    }
+    else
+        hash = seed + XXH_PRIME5;
+
+    hash += (uint64_t)size;
+    for (; p + 8 <= end; p += 8)
+        hash = Rotl64(hash ^ XxhRound(0, Read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if (p + 4 <= end)
+    {
+        hash = Rotl64(hash ^ (Read32(p) * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        hash = Rotl64(hash ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+}
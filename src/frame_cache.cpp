@@ -0,0 +1,122 @@
+#include <ffmpipe/frame_cache.h>
+#include <cstring>
+
+namespace ffmpipe
+{
+
+/// @brief Convert a frame. Returns `false` if the conversion is not supported.
+static bool ConvertFrame(const uint8_t* src, const FrameConversion& conversion, std::vector<uint8_t>& out)
+{
+    const uint32_t bytes_per_pixel = BytesPerPixel(conversion.src_format);
+    if (!bytes_per_pixel || !conversion.factor)
+        return false;
+    if (conversion.dst_format != conversion.src_format && conversion.dst_format != PixelFormat::I420)
+        return false;
+
+    const uint32_t width = conversion.GetOutputWidth();
+    const uint32_t height = conversion.GetOutputHeight();
+    out.resize(FrameSize(conversion.dst_format, width, height));
+
+    if (conversion.factor == 1)
+    {
+        if (conversion.dst_format == PixelFormat::I420)
+            ConvertToI420(src, conversion.src_format, width, height, out.data());
+        else
+            StreamCopy(out.data(), src, out.size());
+        return true;
+    }
+
+    if (conversion.dst_format == conversion.src_format)
+    {
+        Downscale(src, conversion.width, conversion.height, bytes_per_pixel, conversion.factor, out.data());
+        return true;
+    }
+
+    std::vector<uint8_t> scaled(FrameSize(conversion.src_format, width, height));
+    Downscale(src, conversion.width, conversion.height, bytes_per_pixel, conversion.factor, scaled.data());
+    ConvertToI420(scaled.data(), conversion.src_format, width, height, out.data());
+    return true;
+}
+
+FrameCache::FrameCache(size_t max_bytes)
+    : m_max_bytes(max_bytes)
+{}
+
+CachedFrame FrameCache::Convert(const void* src, const FrameConversion& conversion)
+{
+    // The conversion seeds the content hash, so one source converted two ways has two keys
+    const uint64_t params[] = {
+        (uint64_t)conversion.src_format, conversion.width, conversion.height,
+        conversion.factor, (uint64_t)conversion.dst_format,
+    };
+    const uint64_t seed = HashBytes(params, sizeof(params));
+    const uint64_t key = HashBytes(src, FrameSize(conversion.src_format, conversion.width, conversion.height), seed);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto cached = m_cache.find(key);
+        if (cached != m_cache.end())
+        {
+            ++m_hits;
+            m_lru.splice(m_lru.begin(), m_lru, cached->second.lru_it);
+            return cached->second.frame;
+        }
+        ++m_misses;
+    }
+
+    auto frame = std::make_shared<std::vector<uint8_t>>();
+    if (!ConvertFrame((const uint8_t*)src, conversion, *frame))
+        return nullptr;
+
+    Insert(key, frame);
+    return frame;
+}
+
+void FrameCache::Insert(uint64_t key, const CachedFrame& frame)
+{
+    const size_t size = frame->size();
+    if (size > m_max_bytes)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Another thread may have converted the same frame meanwhile
+    if (m_cache.count(key))
+        return;
+
+    while (m_bytes + size > m_max_bytes)
+    {
+        uint64_t oldest = m_lru.back();
+        m_lru.pop_back();
+        auto it = m_cache.find(oldest);
+        m_bytes -= it->second.frame->size();
+        m_cache.erase(it);
+        ++m_evictions;
+    }
+
+    m_lru.push_front(key);
+    m_cache[key] = CacheEntry { frame, m_lru.begin() };
+    m_bytes += size;
+}
+
+void FrameCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lru.clear();
+    m_cache.clear();
+    m_bytes = 0;
+}
+
+FrameCacheStats FrameCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    FrameCacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    stats.entries = m_cache.size();
+    stats.bytes = m_bytes;
+    stats.max_bytes = m_max_bytes;
+    return stats;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,339 @@
+#include <ffmpipe/frame_server.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+namespace ffmpipe
+{
+
+static const char INDEX_MAGIC[8] = { 'F', 'F', 'M', 'P', 'I', 'D', 'X', '1' };
+
+/// @brief FNV-1a, for naming index files
+static uint64_t HashString(std::string_view str)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char ch : str)
+    {
+        hash ^= (uint8_t)ch;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+FrameServer::~FrameServer()
+{
+    for (Decoder& decoder : m_decoders)
+    {
+        decoder.pipe->Terminate();
+        decoder.pipe->Close(0);
+    }
+}
+
+std::shared_ptr<FrameServer> FrameServer::Open(const std::filesystem::path& video_path, const FrameServerOptions& options)
+{
+    if (BytesPerPixel(options.format) == 0)
+        return nullptr;
+
+    std::shared_ptr<FrameServer> server = std::shared_ptr<FrameServer>(new FrameServer);
+    server->m_video_path = video_path;
+    server->m_options = options;
+
+    // The index is named after the file's path, size, and modification time, so edits invalidate it
+    std::error_code error;
+    uintmax_t file_size = std::filesystem::file_size(video_path, error);
+    if (error)
+        return nullptr;
+    auto mtime = std::filesystem::last_write_time(video_path, error).time_since_epoch().count();
+    
+    std::stringstream key;
+    key << std::filesystem::absolute(video_path).u8string() << '|' << file_size << '|' << mtime;
+    std::stringstream name;
+    name << "ffmpipe_" << std::hex << std::setw(16) << std::setfill('0') << HashString(key.str()) << ".idx";
+
+    std::filesystem::path index_dir = options.index_dir.empty() ? std::filesystem::temp_directory_path(error) : options.index_dir;
+    std::filesystem::path index_path = index_dir / name.str();
+
+    if (!server->LoadIndex(index_path))
+    {
+        if (!server->BuildIndex())
+            return nullptr;
+        server->SaveIndex(index_path);
+    }
+
+    server->m_frame_size = FrameSize(options.format, server->m_width, server->m_height);
+    server->m_num_slots = options.cache_bytes / server->m_frame_size;
+    if (server->m_num_slots < 1)
+        server->m_num_slots = 1;
+    server->m_arena.reset(new (std::nothrow) uint8_t[server->m_num_slots * server->m_frame_size]);
+    if (!server->m_arena)
+        return nullptr;
+    
+    for (size_t i = server->m_num_slots; i > 0; --i)
+        server->m_free_slots.push_back(i - 1);
+    return server;
+}
+
+bool FrameServer::LoadIndex(const std::filesystem::path& index_path)
+{
+    std::ifstream file(index_path, std::ios::binary);
+    char magic[sizeof(INDEX_MAGIC)];
+    if (!file.read(magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0)
+        return false;
+
+    uint64_t num_pts = 0, num_keyframes = 0;
+    file.read((char*)&m_width, sizeof(m_width));
+    file.read((char*)&m_height, sizeof(m_height));
+    file.read((char*)&m_time_base_num, sizeof(m_time_base_num));
+    file.read((char*)&m_time_base_den, sizeof(m_time_base_den));
+    file.read((char*)&num_pts, sizeof(num_pts));
+    // Bound the counts by the file, so a corrupt one fails here instead of in a huge allocation
+    std::error_code error;
+    const uint64_t file_size = std::filesystem::file_size(index_path, error);
+    if (!file || num_pts == 0 || error || num_pts > file_size / sizeof(m_pts[0]))
+        return false;
+    m_pts.resize(num_pts);
+    file.read((char*)m_pts.data(), num_pts * sizeof(m_pts[0]));
+    file.read((char*)&num_keyframes, sizeof(num_keyframes));
+    if (!file || num_keyframes == 0 || num_keyframes > file_size / sizeof(m_keyframes[0]))
+        return false;
+    m_keyframes.resize(num_keyframes);
+    file.read((char*)m_keyframes.data(), num_keyframes * sizeof(m_keyframes[0]));
+    if (!file)
+        return false;
+
+    // A stale or corrupt list would send seeks outside m_pts
+    if (!std::is_sorted(m_keyframes.begin(), m_keyframes.end()) || m_keyframes.back() >= num_pts)
+        return false;
+    return m_width && m_height && m_time_base_den;
+}
+
+bool FrameServer::SaveIndex(const std::filesystem::path& index_path) const
+{
+    uint64_t num_pts = m_pts.size(), num_keyframes = m_keyframes.size();
+    std::ofstream file(index_path, std::ios::binary | std::ios::trunc);
+    file.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    file.write((const char*)&m_width, sizeof(m_width));
+    file.write((const char*)&m_height, sizeof(m_height));
+    file.write((const char*)&m_time_base_num, sizeof(m_time_base_num));
+    file.write((const char*)&m_time_base_den, sizeof(m_time_base_den));
+    file.write((const char*)&num_pts, sizeof(num_pts));
+    file.write((const char*)m_pts.data(), num_pts * sizeof(m_pts[0]));
+    file.write((const char*)&num_keyframes, sizeof(num_keyframes));
+    file.write((const char*)m_keyframes.data(), num_keyframes * sizeof(m_keyframes[0]));
+    return (bool)file;
+}
+
+bool FrameServer::BuildIndex()
+{
+    std::wstringstream args;
+    args << L"-v error -select_streams v:0 -show_entries stream=width,height,time_base:packet=pts,flags -of compact=p=1 ";
+    args << QuoteArg(m_video_path.wstring());
+
+    PipeOptions pipe_options = m_options.pipe_options;
+    pipe_options.read_stdout = true;
+    PipePtr pipe = Pipe::Create(m_options.ffprobe_path, args.str(), pipe_options);
+    if (!pipe)
+        return false;
+    pipe->SetPrintFunc(m_print_fn);
+    std::string output;
+    bool read_ok = pipe->ReadAll(output);
+    pipe->Close(m_options.pipe_options.timeout_ms);
+    if (!read_ok || pipe->GetExitCode() != 0)
+        return false;
+
+    // Lines look like `packet|pts=1024|flags=K__` and `stream|width=1920|height=1080|time_base=1/15360`
+    std::vector<std::pair<int64_t, bool>> packets;
+    std::istringstream lines(output);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        std::istringstream fields(line);
+        std::string section, field;
+        std::getline(fields, section, '|');
+
+        std::pair<int64_t, bool> packet = { 0, false };
+        bool has_pts = false;
+        while (std::getline(fields, field, '|'))
+        {
+            size_t eq = field.find('=');
+            if (eq == std::string::npos)
+                continue;
+            std::string key = field.substr(0, eq), value = field.substr(eq + 1);
+            if (!value.empty() && value.back() == '\r')
+                value.pop_back();
+
+            if (section == "packet" && key == "pts" && value != "N/A")
+            {
+                packet.first = std::stoll(value);
+                has_pts = true;
+            }
+            else if (section == "packet" && key == "flags")
+                packet.second = value.find('K') != std::string::npos;
+            else if (section == "stream" && key == "width")
+                m_width = (uint32_t)std::stoul(value);
+            else if (section == "stream" && key == "height")
+                m_height = (uint32_t)std::stoul(value);
+            else if (section == "stream" && key == "time_base")
+            {
+                size_t slash = value.find('/');
+                if (slash != std::string::npos)
+                {
+                    m_time_base_num = std::stoll(value.substr(0, slash));
+                    m_time_base_den = std::stoll(value.substr(slash + 1));
+                }
+            }
+        }
+        if (section == "packet" && has_pts)
+            packets.push_back(packet);
+    }
+
+    if (packets.empty() || !m_width || !m_height || !m_time_base_den)
+        return false;
+
+    // Packets are in decode order. Frames are numbered in display order.
+    std::sort(packets.begin(), packets.end());
+    m_pts.clear();
+    m_keyframes.clear();
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+        m_pts.push_back(packets[i].first);
+        if (packets[i].second || i == 0)
+            m_keyframes.push_back(i);
+    }
+    return true;
+}
+
+uint64_t FrameServer::KeyframeBefore(uint64_t index) const
+{
+    auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), index);
+    return it == m_keyframes.begin() ? 0 : *(it - 1);
+}
+
+FrameServer::Decoder* FrameServer::FindDecoder(uint64_t index)
+{
+    // Reading forward from within the same GOP is never slower than starting at its keyframe
+    uint64_t keyframe = KeyframeBefore(index);
+    Decoder* best = nullptr;
+    for (Decoder& decoder : m_decoders)
+    {
+        if (decoder.next_frame <= index && decoder.next_frame >= keyframe)
+        {
+            if (!best || decoder.next_frame > best->next_frame)
+                best = &decoder;
+        }
+    }
+    return best;
+}
+
+FrameServer::Decoder* FrameServer::StartDecoder(uint64_t keyframe)
+{
+    if (!m_decoders.empty() && m_decoders.size() >= m_options.max_decoders)
+    {
+        auto oldest = std::min_element(m_decoders.begin(), m_decoders.end(), [](const Decoder& a, const Decoder& b) {
+            return a.last_used < b.last_used;
+        });
+        oldest->pipe->Terminate();
+        oldest->pipe->Close(0);
+        m_decoders.erase(oldest);
+    }
+
+    std::wstringstream args;
+    args << L"-v error ";
+    if (keyframe > 0)
+    {
+        // Seek between the previous frame and the keyframe, so the first frame FFmpeg outputs is the keyframe
+        double pts = (m_pts[keyframe - 1] + m_pts[keyframe]) * 0.5;
+        args << L"-seek_timestamp 1 -ss " << std::fixed << std::setprecision(6) << pts * m_time_base_num / m_time_base_den << L' ';
+    }
+    args << L"-i " << QuoteArg(m_video_path.wstring());
+    args << L" -map 0:v:0 -vsync passthrough -f rawvideo -pix_fmt " << PixelFormatName(m_options.format) << L" -";
+
+    PipeOptions pipe_options = m_options.pipe_options;
+    pipe_options.read_stdout = true;
+    PipePtr pipe = Pipe::Create(m_options.ffmpeg_path, args.str(), pipe_options);
+    if (!pipe)
+        return nullptr;
+    pipe->SetPrintFunc(m_print_fn);
+
+    Decoder decoder;
+    decoder.pipe = pipe;
+    decoder.next_frame = keyframe;
+    m_decoders.push_back(decoder);
+    ++m_stats.decoders_started;
+    return &m_decoders.back();
+}
+
+size_t FrameServer::AcquireSlot()
+{
+    if (m_free_slots.empty())
+    {
+        uint64_t oldest = m_lru.back();
+        m_lru.pop_back();
+        auto it = m_cache.find(oldest);
+        m_free_slots.push_back(it->second.slot);
+        m_cache.erase(it);
+    }
+    size_t slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    return slot;
+}
+
+void FrameServer::Insert(uint64_t index, size_t slot)
+{
+    m_lru.push_front(index);
+    m_cache[index] = CacheEntry { slot, m_lru.begin() };
+}
+
+const uint8_t* FrameServer::GetFrame(uint64_t index)
+{
+    if (index >= m_pts.size())
+        return nullptr;
+
+    auto cached = m_cache.find(index);
+    if (cached != m_cache.end())
+    {
+        ++m_stats.hits;
+        m_lru.splice(m_lru.begin(), m_lru, cached->second.lru_it);
+        return m_arena.get() + cached->second.slot * m_frame_size;
+    }
+    ++m_stats.misses;
+
+    Decoder* decoder = FindDecoder(index);
+    if (!decoder)
+        decoder = StartDecoder(KeyframeBefore(index));
+    if (!decoder)
+        return nullptr;
+    decoder->last_used = ++m_use_counter;
+
+    // Every frame on the way is cached, so seeking back within the GOP is free
+    while (decoder->next_frame <= index)
+    {
+        uint64_t frame = decoder->next_frame;
+        size_t slot = AcquireSlot();
+        if (!decoder->pipe->Read(m_arena.get() + slot * m_frame_size, m_frame_size))
+        {
+            m_free_slots.push_back(slot);
+            decoder->pipe->Terminate();
+            decoder->pipe->Close(0);
+            m_decoders.erase(m_decoders.begin() + (decoder - m_decoders.data()));
+            return nullptr;
+        }
+        ++decoder->next_frame;
+        ++m_stats.frames_decoded;
+
+        auto existing = m_cache.find(frame);
+        if (existing != m_cache.end())
+        {
+            m_free_slots.push_back(slot);
+            m_lru.splice(m_lru.begin(), m_lru, existing->second.lru_it);
+        }
+        else
+            Insert(frame, slot);
+    }
+
+    return m_arena.get() + m_cache[index].slot * m_frame_size;
+}
+
+}
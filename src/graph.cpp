@@ -0,0 +1,400 @@
+#include <ffmpipe/graph.h>
+#include "clock.h"
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+namespace ffmpipe
+{
+
+static const SIZE_T STAGE_STACK_SIZE = 256 * 1024;
+
+std::shared_ptr<BufferPool> BufferPool::Create(size_t max_free_bytes)
+{
+    std::shared_ptr<BufferPool> pool = std::shared_ptr<BufferPool>(new BufferPool);
+    pool->m_max_free_bytes = max_free_bytes;
+    return pool;
+}
+
+BufferPool::~BufferPool()
+{
+    for (auto& [size, buffers] : m_free)
+    {
+        for (uint8_t* buffer : buffers)
+            delete[] buffer;
+    }
+}
+
+FramePtr BufferPool::Acquire(size_t size)
+{
+    uint8_t* data = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_free.find(size);
+        if (it != m_free.end() && !it->second.empty())
+        {
+            data = it->second.back();
+            it->second.pop_back();
+            m_free_bytes -= size;
+        }
+    }
+    if (!data)
+        data = new uint8_t[size];
+
+    // Frames keep the pool alive, so they may outlive the graph
+    std::shared_ptr<BufferPool> pool = shared_from_this();
+    Frame* frame = new Frame;
+    frame->data = data;
+    frame->size = size;
+    return FramePtr(frame, [pool](Frame* frame) {
+        pool->Release(frame->data, frame->size);
+        delete frame;
+    });
+}
+
+void BufferPool::Release(uint8_t* data, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_free_bytes + size <= m_max_free_bytes)
+        {
+            m_free[size].push_back(data);
+            m_free_bytes += size;
+            return;
+        }
+    }
+    delete[] data;
+}
+
+Stage::~Stage()
+{
+    Join();
+    if (m_not_empty)
+        CloseHandle(m_not_empty);
+    if (m_not_full)
+        CloseHandle(m_not_full);
+}
+
+StageStats Stage::GetStats() const
+{
+    StageStats stats;
+    stats.name = m_name;
+    stats.frames_in = m_frames_in;
+    stats.frames_out = m_frames_out;
+    stats.frames_dropped = m_frames_dropped;
+    stats.busy_us = m_busy_us;
+    stats.blocked_us = m_blocked_us;
+    if (m_queue)
+    {
+        stats.queue_size = m_queue->Size();
+        stats.queue_capacity = m_queue->Capacity();
+    }
+    return stats;
+}
+
+void Stage::Emit(const FramePtr& frame)
+{
+    ++m_frames_out;
+    for (Stage* stage : m_downstream)
+    {
+        // Inline stages run on this thread, but their time is their own
+        int64_t start = stage->m_queue ? 0 : QpcNow();
+        FramePtr copy = frame;
+        stage->Deliver(std::move(copy));
+        if (!stage->m_queue)
+            m_inline_us += QpcToMicroseconds(QpcNow() - start);
+    }
+}
+
+void Stage::Deliver(FramePtr frame)
+{
+    if (!m_queue)
+    {
+        Run(frame);
+        return;
+    }
+
+    int64_t blocked_qpc = 0;
+    while (!m_queue->TryPush(frame))
+    {
+        int64_t start = QpcNow();
+        WaitForSingleObject(m_not_full, INFINITE);
+        blocked_qpc += QpcNow() - start;
+    }
+    SetEvent(m_not_empty);
+
+    // Blocking is charged to the stage that emitted the frame, or to nobody for FrameGraph::Push
+    if (blocked_qpc)
+        m_upstream_blocked_us(QpcToMicroseconds(blocked_qpc));
+}
+
+void Stage::Run(const FramePtr& frame)
+{
+    if (!frame)
+    {
+        Flush();
+        for (Stage* stage : m_downstream)
+            stage->Deliver(nullptr);
+        return;
+    }
+
+    ++m_frames_in;
+    if (m_failed)
+    {
+        ++m_frames_dropped;
+        return;
+    }
+
+    uint64_t excluded_before = m_blocked_us + m_inline_us;
+    int64_t start = QpcNow();
+    m_failed = !Process(frame);
+    uint64_t elapsed_us = (uint64_t)QpcToMicroseconds(QpcNow() - start);
+    uint64_t excluded_us = m_blocked_us + m_inline_us - excluded_before;
+    m_busy_us += elapsed_us > excluded_us ? elapsed_us - excluded_us : 0;
+}
+
+bool Stage::Start()
+{
+    if (!m_options.threaded)
+        return true;
+
+    m_queue.reset(new SpscQueue<FramePtr>(m_options.queue_capacity ? m_options.queue_capacity : 1));
+    m_not_empty = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+    m_not_full = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+    if (!m_not_empty || !m_not_full)
+        return false;
+
+    m_thread = CreateThread(nullptr, STAGE_STACK_SIZE, ThreadProc, this, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+    return m_thread != NULL;
+}
+
+void Stage::Join()
+{
+    if (!m_thread)
+        return;
+    WaitForSingleObject(m_thread, INFINITE);
+    CloseHandle(m_thread);
+    m_thread = NULL;
+}
+
+void Stage::Stop()
+{
+    if (!m_thread)
+        return;
+    m_stopping = true;
+    FramePtr end;
+    while (!m_queue->TryPush(end))
+        WaitForSingleObject(m_not_full, INFINITE);
+    SetEvent(m_not_empty);
+    Join();
+}
+
+DWORD WINAPI Stage::ThreadProc(LPVOID param)
+{
+    Stage* stage = (Stage*)param;
+    const size_t batch_size = stage->m_options.batch_size ? stage->m_options.batch_size : 1;
+    std::vector<FramePtr> batch;
+    batch.reserve(batch_size);
+
+    for (;;)
+    {
+        FramePtr frame;
+        while (batch.size() < batch_size && stage->m_queue->TryPop(frame))
+            batch.push_back(std::move(frame));
+        
+        if (batch.empty())
+        {
+            WaitForSingleObject(stage->m_not_empty, INFINITE);
+            continue;
+        }
+        
+        // One wakeup per batch for the upstream thread
+        SetEvent(stage->m_not_full);
+        for (FramePtr& queued : batch)
+        {
+            bool end = !queued;
+            if (end && stage->m_stopping)
+                return 0;
+            stage->Run(queued);
+            if (end)
+                return 0;
+        }
+        batch.clear();
+    }
+}
+
+FrameGraph::FrameGraph() {
+    m_pool = BufferPool::Create();
+}
+
+FrameGraph::~FrameGraph()
+{
+    if (m_started)
+        Finish();
+}
+
+void FrameGraph::AddStage(std::unique_ptr<Stage> stage, const StageOptions& options)
+{
+    stage->m_options = options;
+    stage->m_pool = m_pool;
+    m_stages.push_back(std::move(stage));
+}
+
+bool FrameGraph::Start()
+{
+    // Each stage charges time blocked on a downstream queue to itself
+    for (std::unique_ptr<Stage>& stage : m_stages)
+    {
+        Stage* upstream = stage.get();
+        for (Stage* downstream : upstream->m_downstream)
+            downstream->m_upstream_blocked_us = [upstream](uint64_t us) { upstream->m_blocked_us += us; };
+    }
+
+    for (size_t i = 0; i < m_stages.size(); ++i)
+    {
+        if (!m_stages[i]->Start())
+        {
+            // Nothing was pushed, so the stages already started only need their threads ended
+            for (size_t j = 0; j <= i; ++j)
+                m_stages[j]->Stop();
+            return false;
+        }
+    }
+    m_started = true;
+    m_start_qpc = QpcNow();
+    return true;
+}
+
+void FrameGraph::Push(FramePtr frame)
+{
+    if (!m_stages.empty())
+        m_stages.front()->Deliver(std::move(frame));
+}
+
+void FrameGraph::Push(const void* data, uint32_t width, uint32_t height, PixelFormat format)
+{
+    FramePtr frame = NewFrame(FrameSize(format, width, height));
+    StreamCopy(frame->data, data, frame->size);
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    frame->index = m_next_index++;
+    Push(std::move(frame));
+}
+
+void FrameGraph::Finish()
+{
+    if (!m_started)
+        return;
+    Push(nullptr);
+    for (std::unique_ptr<Stage>& stage : m_stages)
+        stage->Join();
+    m_started = false;
+}
+
+std::vector<StageStats> FrameGraph::GetStats() const
+{
+    std::vector<StageStats> stats;
+    for (const std::unique_ptr<Stage>& stage : m_stages)
+        stats.push_back(stage->GetStats());
+    return stats;
+}
+
+std::string FrameGraph::Report() const
+{
+    std::vector<StageStats> stats = GetStats();
+    double elapsed_s = m_start_qpc ? QpcToMicroseconds(QpcNow() - m_start_qpc) / 1e6 : 0;
+    if (elapsed_s <= 0)
+        elapsed_s = 1;
+
+    size_t bottleneck = 0;
+    for (size_t i = 1; i < stats.size(); ++i)
+    {
+        if (stats[i].busy_us > stats[bottleneck].busy_us)
+            bottleneck = i;
+    }
+
+    std::stringstream report;
+    report << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        const StageStats& stage = stats[i];
+        report << stage.name << ": " << stage.frames_in / elapsed_s << " fps in, ";
+        report << stage.frames_dropped << " dropped, busy " << stage.busy_us / 1e4 / elapsed_s << "%, ";
+        report << "blocked " << stage.blocked_us / 1e4 / elapsed_s << "%, ";
+        report << "queue " << stage.queue_size << '/' << stage.queue_capacity;
+        if (i == bottleneck)
+            report << " <- bottleneck";
+        report << '\n';
+    }
+    return report.str();
+}
+
+bool ConvertStage::Process(const FramePtr& frame)
+{
+    if (frame->format == PixelFormat::I420)
+    {
+        Emit(frame);
+        return true;
+    }
+    if (BytesPerPixel(frame->format) == 0)
+        return false;
+
+    FramePtr out = NewFrame(FrameSize(PixelFormat::I420, frame->width, frame->height));
+    ConvertToI420(frame->data, frame->format, frame->width, frame->height, out->data);
+    out->width = frame->width;
+    out->height = frame->height;
+    out->format = PixelFormat::I420;
+    out->index = frame->index;
+    Emit(out);
+    return true;
+}
+
+bool ScaleStage::Process(const FramePtr& frame)
+{
+    uint32_t bytes_per_pixel = BytesPerPixel(frame->format);
+    if (bytes_per_pixel == 0)
+        return false;
+
+    uint32_t width = frame->width / m_factor, height = frame->height / m_factor;
+    FramePtr out = NewFrame(FrameSize(frame->format, width, height));
+    Downscale(frame->data, frame->width, frame->height, bytes_per_pixel, m_factor, out->data);
+    out->width = width;
+    out->height = height;
+    out->format = frame->format;
+    out->index = frame->index;
+    Emit(out);
+    return true;
+}
+
+bool DedupeStage::Process(const FramePtr& frame)
+{
+    uint64_t hash = HashBytes(frame->data, frame->size);
+    if (m_has_last && hash == m_last_hash && frame->size == m_last_size)
+    {
+        CountDrop();
+        return true;
+    }
+
+    m_last_hash = hash;
+    m_last_size = frame->size;
+    m_has_last = true;
+    Emit(frame);
+    return true;
+}
+
+bool TeeStage::Process(const FramePtr& frame)
+{
+    Emit(frame);
+    return true;
+}
+
+bool PipeSinkStage::Process(const FramePtr& frame) {
+    return m_pipe->Write(frame->data, frame->size);
+}
+
+void PipeSinkStage::Flush() {
+    m_pipe->Close();
+}
+
+}
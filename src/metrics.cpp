@@ -0,0 +1,356 @@
+#include <ffmpipe/metrics.h>
+#include <winsock2.h>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+namespace ffmpipe
+{
+
+static const SIZE_T METRICS_STACK_SIZE = 128 * 1024;
+
+static std::string EscapeLabel(std::string_view value)
+{
+    std::string escaped;
+    for (char ch : value)
+    {
+        if (ch == '\\' || ch == '"')
+            escaped.push_back('\\');
+        if (ch == '\n')
+        {
+            escaped += "\\n";
+            continue;
+        }
+        escaped.push_back(ch);
+    }
+    return escaped;
+}
+
+/// @brief Samples of one metric family across all pipes or caches
+struct MetricFamily
+{
+    const char* name;
+    const char* type;
+    const char* unit;
+    const char* help;
+    std::stringstream samples;
+};
+
+void MetricsRegistry::Add(std::string name, const PipePtr& pipe)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pipes.emplace_back(std::move(name), pipe);
+}
+
+void MetricsRegistry::AddCache(std::string name, const std::shared_ptr<FrameCache>& cache)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_caches.emplace_back(std::move(name), cache);
+}
+
+void MetricsRegistry::AddCache(std::string name, const std::shared_ptr<SegmentCache>& cache)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_segment_caches.emplace_back(std::move(name), cache);
+}
+
+void MetricsRegistry::Remove(std::string_view name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto has_name = [&](const auto& entry) { return entry.first == name; };
+    m_pipes.erase(std::remove_if(m_pipes.begin(), m_pipes.end(), has_name), m_pipes.end());
+    m_caches.erase(std::remove_if(m_caches.begin(), m_caches.end(), has_name), m_caches.end());
+    m_segment_caches.erase(std::remove_if(m_segment_caches.begin(), m_segment_caches.end(), has_name), m_segment_caches.end());
+}
+
+std::string MetricsRegistry::Render() {
+    return Render(true);
+}
+
+std::string MetricsRegistry::Render(bool openmetrics)
+{
+    std::vector<std::pair<std::string, PipePtr>> pipes;
+    std::vector<std::pair<std::string, std::shared_ptr<FrameCache>>> caches;
+    std::vector<std::pair<std::string, std::shared_ptr<SegmentCache>>> segment_caches;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_pipes.begin(); it != m_pipes.end();)
+        {
+            if (PipePtr pipe = it->second.lock())
+            {
+                pipes.emplace_back(it->first, pipe);
+                ++it;
+            }
+            else
+                it = m_pipes.erase(it);
+        }
+        for (auto it = m_caches.begin(); it != m_caches.end();)
+        {
+            if (std::shared_ptr<FrameCache> cache = it->second.lock())
+            {
+                caches.emplace_back(it->first, cache);
+                ++it;
+            }
+            else
+                it = m_caches.erase(it);
+        }
+        for (auto it = m_segment_caches.begin(); it != m_segment_caches.end();)
+        {
+            if (std::shared_ptr<SegmentCache> cache = it->second.lock())
+            {
+                segment_caches.emplace_back(it->first, cache);
+                ++it;
+            }
+            else
+                it = m_segment_caches.erase(it);
+        }
+    }
+
+    enum
+    {
+        WRITTEN, WRITE_TIME, BLOCKED_TIME, QUEUED, LATENCY,
+        FRAMES, DROPPED, FPS, SPEED, CPU, RESIDENT, STARTUP,
+        CACHE_HITS, CACHE_MISSES, CACHE_EVICTIONS, CACHE_BYTES, CACHE_ENTRIES,
+        SEGMENT_HITS, SEGMENT_MISSES, SEGMENT_EVICTIONS, SEGMENT_BYTES, SEGMENT_ENTRIES,
+        COUNT
+    };
+    MetricFamily families[COUNT] = {
+        { "ffmpipe_written_bytes", "counter", "bytes", "Bytes accepted by FFmpeg's stdin" },
+        { "ffmpipe_write_seconds", "counter", "seconds", "Time spent in Pipe::Write" },
+        { "ffmpipe_blocked_seconds", "counter", "seconds", "Time spent in Pipe::Write waiting for FFmpeg to read" },
+        { "ffmpipe_queued_bytes", "gauge", "bytes", "Bytes in the stdin pipe that FFmpeg has not read" },
+        { "ffmpipe_write_latency_seconds", "summary", "seconds", "Time from Pipe::Write until FFmpeg was seen to have read the data" },
+        { "ffmpipe_encoder_frames", "counter", "", "Frames reported by FFmpeg" },
+        { "ffmpipe_encoder_dropped_frames", "counter", "", "Dropped frames reported by FFmpeg" },
+        { "ffmpipe_encoder_fps", "gauge", "", "Encoding rate reported by FFmpeg" },
+        { "ffmpipe_encoder_speed_ratio", "gauge", "ratio", "Encoding speed relative to realtime reported by FFmpeg" },
+        { "ffmpipe_child_cpu_seconds", "counter", "seconds", "User and kernel CPU time of FFmpeg" },
+        { "ffmpipe_child_resident_bytes", "gauge", "bytes", "Working set of FFmpeg" },
+        { "ffmpipe_startup_seconds", "gauge", "seconds", "Duration of each startup phase, or time from Pipe::Create to each milestone" },
+        { "ffmpipe_frame_cache_hits", "counter", "", "Conversions served from a frame cache" },
+        { "ffmpipe_frame_cache_misses", "counter", "", "Conversions computed by a frame cache" },
+        { "ffmpipe_frame_cache_evictions", "counter", "", "Frames evicted from a frame cache to stay within its budget" },
+        { "ffmpipe_frame_cache_bytes", "gauge", "bytes", "Size of the frames held by a frame cache" },
+        { "ffmpipe_frame_cache_entries", "gauge", "", "Number of frames held by a frame cache" },
+        { "ffmpipe_segment_cache_hits", "counter", "", "Segments taken from a segment cache instead of encoded" },
+        { "ffmpipe_segment_cache_misses", "counter", "", "Segments looked up in a segment cache and not found" },
+        { "ffmpipe_segment_cache_evictions", "counter", "", "Segments evicted from a segment cache to stay within its budget" },
+        { "ffmpipe_segment_cache_bytes", "gauge", "bytes", "Size of the segments held by a segment cache" },
+        { "ffmpipe_segment_cache_entries", "gauge", "", "Number of segments held by a segment cache" },
+    };
+
+    for (const auto& [name, pipe] : pipes)
+    {
+        const std::string labels = "{pipe=\"" + EscapeLabel(name) + "\"} ";
+        PipeStats stats = pipe->GetStats();
+        PipeProcessUsage usage = pipe->GetProcessUsage();
+
+        families[WRITTEN].samples << families[WRITTEN].name << "_total" << labels << stats.bytes_written << '\n';
+        families[WRITE_TIME].samples << families[WRITE_TIME].name << "_total" << labels << stats.write_us / 1e6 << '\n';
+        families[BLOCKED_TIME].samples << families[BLOCKED_TIME].name << "_total" << labels << stats.wait_us / 1e6 << '\n';
+        families[QUEUED].samples << families[QUEUED].name << labels << stats.queued_bytes << '\n';
+        families[LATENCY].samples << families[LATENCY].name << "_sum" << labels << stats.latency_total_us / 1e6 << '\n';
+        families[LATENCY].samples << families[LATENCY].name << "_count" << labels << stats.latency_samples << '\n';
+        families[FRAMES].samples << families[FRAMES].name << "_total" << labels << stats.frames << '\n';
+        families[DROPPED].samples << families[DROPPED].name << "_total" << labels << stats.dropped_frames << '\n';
+        families[FPS].samples << families[FPS].name << labels << stats.fps << '\n';
+        families[SPEED].samples << families[SPEED].name << labels << stats.speed << '\n';
+        families[CPU].samples << families[CPU].name << "_total" << labels << usage.cpu_seconds << '\n';
+        families[RESIDENT].samples << families[RESIDENT].name << labels << usage.resident_bytes << '\n';
+
+        // Milestones that have not happened yet are left out
+        const std::pair<const char*, uint64_t> startup[] = {
+            { "pipes", stats.startup.pipes_us }, { "spawn", stats.startup.spawn_us },
+            { "first_read_seen", stats.startup.first_read_seen_us },
+            { "first_output", stats.startup.first_output_us }, { "first_progress", stats.startup.first_progress_us },
+        };
+        for (const auto& [phase, us] : startup)
+        {
+            if (!us && strncmp(phase, "first_", 6) == 0)
+                continue;
+            families[STARTUP].samples << families[STARTUP].name << "{pipe=\"" << EscapeLabel(name) << "\",phase=\"";
+            families[STARTUP].samples << phase << "\"} " << us / 1e6 << '\n';
+        }
+    }
+
+    for (const auto& [name, cache] : caches)
+    {
+        const std::string labels = "{cache=\"" + EscapeLabel(name) + "\"} ";
+        FrameCacheStats stats = cache->GetStats();
+
+        families[CACHE_HITS].samples << families[CACHE_HITS].name << "_total" << labels << stats.hits << '\n';
+        families[CACHE_MISSES].samples << families[CACHE_MISSES].name << "_total" << labels << stats.misses << '\n';
+        families[CACHE_EVICTIONS].samples << families[CACHE_EVICTIONS].name << "_total" << labels << stats.evictions << '\n';
+        families[CACHE_BYTES].samples << families[CACHE_BYTES].name << labels << stats.bytes << '\n';
+        families[CACHE_ENTRIES].samples << families[CACHE_ENTRIES].name << labels << stats.entries << '\n';
+    }
+
+    for (const auto& [name, cache] : segment_caches)
+    {
+        const std::string labels = "{cache=\"" + EscapeLabel(name) + "\"} ";
+        SegmentCacheStats stats = cache->GetStats();
+
+        families[SEGMENT_HITS].samples << families[SEGMENT_HITS].name << "_total" << labels << stats.hits << '\n';
+        families[SEGMENT_MISSES].samples << families[SEGMENT_MISSES].name << "_total" << labels << stats.misses << '\n';
+        families[SEGMENT_EVICTIONS].samples << families[SEGMENT_EVICTIONS].name << "_total" << labels << stats.evictions << '\n';
+        families[SEGMENT_BYTES].samples << families[SEGMENT_BYTES].name << labels << stats.bytes << '\n';
+        families[SEGMENT_ENTRIES].samples << families[SEGMENT_ENTRIES].name << labels << stats.entries << '\n';
+    }
+
+    std::stringstream out;
+    for (MetricFamily& family : families)
+    {
+        // OpenMetrics names a counter family without the `_total` of its samples, and 0.0.4 with it
+        std::string name = family.name;
+        if (!openmetrics && strcmp(family.type, "counter") == 0)
+            name += "_total";
+        out << "# TYPE " << name << ' ' << family.type << '\n';
+        if (openmetrics && *family.unit)
+            out << "# UNIT " << name << ' ' << family.unit << '\n';
+        out << "# HELP " << name << ' ' << family.help << '\n';
+        out << family.samples.str();
+    }
+    if (openmetrics)
+        out << "# EOF\n";
+    return out.str();
+}
+
+bool MetricsRegistry::WriteTextfile(const std::filesystem::path& path)
+{
+    std::string text = Render(false);
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file << text;
+        if (!file.flush())
+            return false;
+    }
+    return MoveFileExW(temp_path.wstring().c_str(), path.wstring().c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+MetricsServer::MetricsServer(std::shared_ptr<MetricsRegistry> registry)
+    : m_registry(std::move(registry)), m_socket(INVALID_SOCKET) {}
+
+MetricsServer::~MetricsServer() {
+    Stop();
+}
+
+bool MetricsServer::Start(uint16_t port)
+{
+    if (m_thread)
+        return false;
+
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        return false;
+    m_wsa_started = true;
+
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET)
+        return false;
+    m_socket = listener;
+    
+    BOOL exclusive = TRUE;
+    setsockopt(listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char*)&exclusive, sizeof(exclusive));
+
+    sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR || listen(listener, SOMAXCONN) == SOCKET_ERROR)
+    {
+        Stop();
+        return false;
+    }
+
+    m_thread = CreateThread(nullptr, METRICS_STACK_SIZE, ThreadProc, this, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+    if (!m_thread)
+    {
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+void MetricsServer::Stop()
+{
+    // Closing the socket makes the blocked accept fail, ending the thread
+    if (m_socket != INVALID_SOCKET)
+    {
+        closesocket((SOCKET)m_socket);
+        m_socket = INVALID_SOCKET;
+    }
+    if (m_thread)
+    {
+        WaitForSingleObject(m_thread, INFINITE);
+        CloseHandle(m_thread);
+        m_thread = NULL;
+    }
+    if (m_wsa_started)
+    {
+        WSACleanup();
+        m_wsa_started = false;
+    }
+}
+
+DWORD WINAPI MetricsServer::ThreadProc(LPVOID param)
+{
+    MetricsServer* server = (MetricsServer*)param;
+    SOCKET listener = (SOCKET)server->m_socket;
+
+    SOCKET client;
+    while ((client = accept(listener, nullptr, nullptr)) != INVALID_SOCKET)
+    {
+        server->Serve(client);
+        closesocket(client);
+    }
+    return 0;
+}
+
+void MetricsServer::Serve(uintptr_t client)
+{
+    SOCKET connection = (SOCKET)client;
+    DWORD timeout_ms = 2000;
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout_ms, sizeof(timeout_ms));
+
+    // Only the request line matters, but the headers are drained so the client sees a clean close
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+        int received = recv(connection, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+            return;
+        request.append(buffer, received);
+    }
+
+    std::string status = "404 Not Found", content_type = "text/plain", body = "Not found\n";
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET /metrics?", 0) == 0)
+    {
+        status = "200 OK";
+        content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+        body = m_registry->Render();
+    }
+
+    std::stringstream response;
+    response << "HTTP/1.1 " << status << "\r\n";
+    response << "Content-Type: " << content_type << "\r\n";
+    response << "Content-Length: " << body.size() << "\r\n";
+    response << "Connection: close\r\n\r\n";
+    response << body;
+
+    std::string data = response.str();
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        int result = send(connection, data.data() + sent, (int)(data.size() - sent), 0);
+        if (result <= 0)
+            return;
+        sent += result;
+    }
+    shutdown(connection, SD_BOTH);
+}
+
+}
@@ -0,0 +1,96 @@
+#include <ffmpipe/preview.h>
+#include <cstring>
+
+namespace ffmpipe
+{
+
+static const SIZE_T PREVIEW_STACK_SIZE = 64 * 1024;
+
+PreviewTap::PreviewTap(uint32_t width, uint32_t height, PixelFormat format, uint32_t factor, uint32_t interval)
+    : m_width(width), m_height(height), m_bytes_per_pixel(BytesPerPixel(format)),
+    m_factor(factor ? factor : 1), m_interval(interval ? interval : 1)
+{
+    m_staging.resize((size_t)width * height * m_bytes_per_pixel);
+    for (std::vector<uint8_t>& preview : m_previews)
+        preview.resize((size_t)GetPreviewWidth() * GetPreviewHeight() * m_bytes_per_pixel);
+
+    m_work_event = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+    if (m_work_event)
+    {
+        m_thread = CreateThread(nullptr, PREVIEW_STACK_SIZE, ThreadProc, this, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+        if (m_thread)
+            SetThreadPriority(m_thread, THREAD_PRIORITY_BELOW_NORMAL);
+    }
+}
+
+PreviewTap::~PreviewTap()
+{
+    if (m_thread)
+    {
+        m_stop = true;
+        SetEvent(m_work_event);
+        WaitForSingleObject(m_thread, INFINITE);
+        CloseHandle(m_thread);
+    }
+    if (m_work_event)
+        CloseHandle(m_work_event);
+}
+
+bool PreviewTap::Submit(const void* frame)
+{
+    uint64_t index = m_frame_index++;
+    if (index % m_interval != 0 || !m_thread || m_bytes_per_pixel == 0)
+        return false;
+    
+    if (m_staging_busy.load(std::memory_order_acquire))
+    {
+        ++m_skipped;
+        return false;
+    }
+
+    StreamCopy(m_staging.data(), frame, m_staging.size());
+    m_staging_index = index;
+    m_staging_busy.store(true, std::memory_order_release);
+    SetEvent(m_work_event);
+    return true;
+}
+
+bool PreviewTap::GetPreview(std::vector<uint8_t>& out, uint64_t* out_frame_index) const
+{
+    std::lock_guard<std::mutex> lock(m_front_mutex);
+    if (!m_has_preview)
+        return false;
+    
+    out = m_previews[m_front];
+    if (out_frame_index)
+        *out_frame_index = m_preview_index;
+    return true;
+}
+
+DWORD WINAPI PreviewTap::ThreadProc(LPVOID param)
+{
+    PreviewTap* tap = (PreviewTap*)param;
+
+    while (WaitForSingleObject(tap->m_work_event, INFINITE) == WAIT_OBJECT_0 && !tap->m_stop)
+    {
+        if (!tap->m_staging_busy.load(std::memory_order_acquire))
+            continue;
+        
+        // Only this thread swaps buffers, so the back buffer can be read without the lock
+        size_t back = tap->m_front ^ 1;
+        Downscale(
+            tap->m_staging.data(), tap->m_width, tap->m_height, tap->m_bytes_per_pixel,
+            tap->m_factor, tap->m_previews[back].data()
+        );
+        uint64_t index = tap->m_staging_index;
+        tap->m_staging_busy.store(false, std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock(tap->m_front_mutex);
+        tap->m_front = back;
+        tap->m_preview_index = index;
+        tap->m_has_preview = true;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,325 @@
+#include <ffmpipe/probe.h>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+namespace ffmpipe
+{
+
+/**
+ * @brief A pull parser for JSON text.
+ * @details Commas and colons are skipped, so keys and values are both returned as String tokens.
+ * This is enough for well-formed input such as FFprobe's output.
+ */
+class JsonReader
+{
+public:
+    enum class Token
+    {
+        End,
+        Error,
+        BeginObject,
+        EndObject,
+        BeginArray,
+        EndArray,
+        String,
+        /// @brief A number, `true`, `false`, or `null`
+        Literal,
+    };
+
+    explicit JsonReader(std::string_view text) : m_text(text) {}
+
+    Token Next()
+    {
+        while (m_pos < m_text.size())
+        {
+            char ch = m_text[m_pos];
+            if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == ',' || ch == ':')
+            {
+                ++m_pos;
+                continue;
+            }
+            
+            switch (ch)
+            {
+            case '{': ++m_pos; return Token::BeginObject;
+            case '}': ++m_pos; return Token::EndObject;
+            case '[': ++m_pos; return Token::BeginArray;
+            case ']': ++m_pos; return Token::EndArray;
+            case '"': return ReadString();
+            default: return ReadLiteral();
+            }
+        }
+        return Token::End;
+    }
+
+    /// @brief Text of the last String or Literal. Valid until the next call to Next.
+    std::string_view Value() const { return m_value; }
+
+    /// @brief Skip the rest of a value that began with `token`
+    bool Skip(Token token)
+    {
+        int depth = 0;
+        do
+        {
+            if (token == Token::BeginObject || token == Token::BeginArray)
+                ++depth;
+            else if (token == Token::EndObject || token == Token::EndArray)
+                --depth;
+            else if (token == Token::End || token == Token::Error)
+                return false;
+        } while (depth > 0 && (token = Next()) != Token::End);
+        return depth == 0;
+    }
+
+private:
+    Token ReadString()
+    {
+        size_t begin = ++m_pos;
+        size_t end = m_text.find_first_of("\"\\", begin);
+        if (end == std::string_view::npos)
+            return Token::Error;
+        
+        if (m_text[end] == '"')
+        {
+            // No escapes, so the value points into the text
+            m_value = m_text.substr(begin, end - begin);
+            m_pos = end + 1;
+            return Token::String;
+        }
+
+        m_scratch.assign(m_text.substr(begin, end - begin));
+        m_pos = end;
+        while (m_pos < m_text.size() && m_text[m_pos] != '"')
+        {
+            char ch = m_text[m_pos++];
+            if (ch != '\\')
+            {
+                m_scratch.push_back(ch);
+                continue;
+            }
+            if (m_pos >= m_text.size())
+                return Token::Error;
+            
+            switch (char escape = m_text[m_pos++])
+            {
+            case 'n': m_scratch.push_back('\n'); break;
+            case 't': m_scratch.push_back('\t'); break;
+            case 'r': m_scratch.push_back('\r'); break;
+            case 'b': m_scratch.push_back('\b'); break;
+            case 'f': m_scratch.push_back('\f'); break;
+            case 'u':
+            {
+                if (m_pos + 4 > m_text.size())
+                    return Token::Error;
+                uint32_t code = (uint32_t)strtoul(std::string(m_text.substr(m_pos, 4)).c_str(), nullptr, 16);
+                m_pos += 4;
+                AppendUtf8(code);
+                break;
+            }
+            default: m_scratch.push_back(escape); break;
+            }
+        }
+        if (m_pos >= m_text.size())
+            return Token::Error;
+        ++m_pos;
+        m_value = m_scratch;
+        return Token::String;
+    }
+
+    Token ReadLiteral()
+    {
+        size_t begin = m_pos;
+        while (m_pos < m_text.size() && !strchr(" \t\r\n,:]}", m_text[m_pos]))
+            ++m_pos;
+        if (m_pos == begin)
+            return Token::Error;
+        m_value = m_text.substr(begin, m_pos - begin);
+        return Token::Literal;
+    }
+
+    /// @brief Surrogate pairs are not combined. FFprobe escapes only control characters.
+    void AppendUtf8(uint32_t code)
+    {
+        if (code < 0x80)
+            m_scratch.push_back((char)code);
+        else if (code < 0x800)
+        {
+            m_scratch.push_back((char)(0xC0 | (code >> 6)));
+            m_scratch.push_back((char)(0x80 | (code & 0x3F)));
+        }
+        else
+        {
+            m_scratch.push_back((char)(0xE0 | (code >> 12)));
+            m_scratch.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+            m_scratch.push_back((char)(0x80 | (code & 0x3F)));
+        }
+    }
+
+    std::string_view m_text;
+    size_t m_pos = 0;
+    std::string_view m_value;
+    std::string m_scratch;
+};
+
+using Token = JsonReader::Token;
+
+/// @brief FFprobe writes many numbers as strings, so both are parsed from text
+static double ToDouble(std::string_view value) {
+    return strtod(std::string(value).c_str(), nullptr);
+}
+
+static int64_t ToInt(std::string_view value) {
+    return strtoll(std::string(value).c_str(), nullptr, 10);
+}
+
+static void ParseFraction(std::string_view value, int64_t& num, int64_t& den)
+{
+    size_t slash = value.find('/');
+    if (slash == std::string_view::npos)
+        return;
+    num = ToInt(value.substr(0, slash));
+    den = ToInt(value.substr(slash + 1));
+}
+
+/**
+ * @brief Call `on_field` for each scalar field of an object. Nested values are skipped.
+ * @details The object's BeginObject token must already be read.
+ */
+template <class FieldFunc>
+static bool ParseFields(JsonReader& reader, FieldFunc on_field)
+{
+    std::string key;
+    Token token;
+    while ((token = reader.Next()) == Token::String)
+    {
+        key = reader.Value();
+        token = reader.Next();
+        if (token == Token::String || token == Token::Literal)
+            on_field(key, reader.Value());
+        else if (!reader.Skip(token))
+            return false;
+    }
+    return token == Token::EndObject;
+}
+
+static void SetStreamField(ProbeStream& stream, std::string_view key, std::string_view value)
+{
+    if (key == "index") stream.index = (int)ToInt(value);
+    else if (key == "codec_type") stream.codec_type = value;
+    else if (key == "codec_name") stream.codec_name = value;
+    else if (key == "pix_fmt") stream.pix_fmt = value;
+    else if (key == "sample_fmt") stream.sample_fmt = value;
+    else if (key == "width") stream.width = (uint32_t)ToInt(value);
+    else if (key == "height") stream.height = (uint32_t)ToInt(value);
+    else if (key == "avg_frame_rate") ParseFraction(value, stream.frame_rate_num, stream.frame_rate_den);
+    else if (key == "sample_rate") stream.sample_rate = (uint32_t)ToInt(value);
+    else if (key == "channels") stream.channels = (uint32_t)ToInt(value);
+    else if (key == "duration") stream.duration = ToDouble(value);
+    else if (key == "nb_frames") stream.nb_frames = (uint64_t)ToInt(value);
+    else if (key == "bit_rate") stream.bit_rate = ToInt(value);
+}
+
+static void SetFormatField(ProbeResult& result, std::string_view key, std::string_view value)
+{
+    if (key == "format_name") result.format_name = value;
+    else if (key == "duration") result.duration = ToDouble(value);
+    else if (key == "size") result.size = (uint64_t)ToInt(value);
+    else if (key == "bit_rate") result.bit_rate = ToInt(value);
+}
+
+bool ParseProbeJson(std::string_view json, ProbeResult& out)
+{
+    JsonReader reader(json);
+    if (reader.Next() != Token::BeginObject)
+        return false;
+
+    std::string key;
+    Token token;
+    while ((token = reader.Next()) == Token::String)
+    {
+        key = reader.Value();
+        token = reader.Next();
+
+        if (key == "streams" && token == Token::BeginArray)
+        {
+            while ((token = reader.Next()) == Token::BeginObject)
+            {
+                ProbeStream& stream = out.streams.emplace_back();
+                if (!ParseFields(reader, [&](std::string_view key, std::string_view value) { SetStreamField(stream, key, value); }))
+                    return false;
+            }
+            if (token != Token::EndArray)
+                return false;
+        }
+        else if (key == "format" && token == Token::BeginObject)
+        {
+            if (!ParseFields(reader, [&](std::string_view key, std::string_view value) { SetFormatField(out, key, value); }))
+                return false;
+        }
+        else if (!reader.Skip(token))
+            return false;
+    }
+    return token == Token::EndObject;
+}
+
+ProbeCache::ProbeCache(std::filesystem::path ffprobe_path, PipeOptions options)
+    : m_ffprobe_path(std::move(ffprobe_path)), m_options(options)
+{
+    m_options.read_stdout = true;
+}
+
+std::shared_ptr<const ProbeResult> ProbeCache::Probe(const std::filesystem::path& media_path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(media_path.wstring().c_str(), GetFileExInfoStandard, &attributes))
+        return nullptr;
+    uint64_t size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    uint64_t mtime = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    std::wstring key = media_path.wstring();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end() && it->second.size == size && it->second.mtime == mtime)
+        {
+            ++m_stats.hits;
+            return it->second.result;
+        }
+        ++m_stats.misses;
+    }
+
+    // Concurrent misses on the same file may both run FFprobe. The results are the same.
+    std::wstringstream args;
+    args << L"-v error -print_format json -show_format -show_streams " << QuoteArg(key);
+    PipePtr pipe = Pipe::Create(m_ffprobe_path, args.str(), m_options);
+    if (!pipe)
+        return nullptr;
+    pipe->SetPrintFunc(nullptr);
+
+    std::string json;
+    bool read_ok = pipe->ReadAll(json);
+    pipe->Close(m_options.timeout_ms);
+    
+    std::shared_ptr<ProbeResult> result = std::make_shared<ProbeResult>();
+    if (!read_ok || pipe->GetExitCode() != 0 || !ParseProbeJson(json, *result))
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[key] = Entry { size, mtime, result };
+    return result;
+}
+
+void ProbeCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+ProbeCache::Stats ProbeCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+}
@@ -0,0 +1,131 @@
+#include <ffmpipe/profiler.h>
+#include "clock.h"
+#include <sstream>
+#include <iomanip>
+
+namespace ffmpipe
+{
+
+/// @brief About how often FFmpeg reports progress, so a shorter window may see no new frame count
+static const int64_t PROGRESS_INTERVAL_US = 500'000;
+
+std::string StallBreakdown::Verdict() const
+{
+    if (wall_s <= 0)
+        return "no data";
+
+    const double producer = producer_idle_s / wall_s;
+    const double encoder = encoder_bound_s / wall_s;
+    const double pipe = (pipe_blocked_s + write_overhead_s) / wall_s;
+
+    const char* verdict = "producer-bound";
+    if (encoder >= producer && encoder >= pipe)
+        verdict = "encoder-bound";
+    else if (pipe >= producer && pipe >= encoder)
+        verdict = "pipe-bound";
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(0);
+    ss << verdict << ": " << encoder * 100 << "% encoder, " << producer * 100 << "% producer, " << pipe * 100 << "% pipe";
+    ss << std::setprecision(2) << " (speed " << encoder_speed << "x, ";
+    ss << std::setprecision(0) << "pipe " << pipe_fill * 100 << "% full)";
+    return ss.str();
+}
+
+StallProfiler::StallProfiler(PipePtr pipe, DWORD window_ms, size_t window_count)
+    : m_pipe(std::move(pipe)), m_window_ms(window_ms ? window_ms : 1), m_window_count(window_count ? window_count : 1)
+{
+    m_last_stats = m_pipe->GetStats();
+    m_last_sample_qpc = m_window_start_qpc = QpcNow();
+    m_window_start_frames = m_last_stats.frames;
+}
+
+void StallProfiler::Sample()
+{
+    PipeStats stats = m_pipe->GetStats();
+    int64_t now_qpc = QpcNow();
+
+    double wall_s = QpcToMicroseconds(now_qpc - m_last_sample_qpc) / 1e6;
+    double write_s = (stats.write_us - m_last_stats.write_us) / 1e6;
+    double wait_s = (stats.wait_us - m_last_stats.wait_us) / 1e6;
+    if (write_s > wall_s)
+        wall_s = write_s; // The pipe's counters are read slightly after its clock
+
+    m_current.wall_s += wall_s;
+    m_current.producer_idle_s += wall_s - write_s;
+    m_current.write_overhead_s += write_s > wait_s ? write_s - wait_s : 0;
+    m_window_wait_s += wait_s;
+    m_current.encoder_speed = stats.speed;
+
+    if (stats.stdin_buffer_size)
+    {
+        m_fill_sum += (double)stats.queued_bytes / stats.stdin_buffer_size;
+        ++m_fill_samples;
+    }
+
+    m_last_stats = stats;
+    m_last_sample_qpc = now_qpc;
+
+    if (QpcToMicroseconds(now_qpc - m_window_start_qpc) >= (int64_t)m_window_ms * 1000)
+    {
+        m_windows.push_back(CurrentWindow());
+        if (m_windows.size() > m_window_count)
+            m_windows.pop_front();
+        ++m_completed_windows;
+
+        m_current = StallBreakdown();
+        m_fill_sum = 0;
+        m_fill_samples = 0;
+        m_window_wait_s = 0;
+        m_window_start_frames = stats.frames;
+        m_window_start_qpc = now_qpc;
+    }
+}
+
+StallBreakdown StallProfiler::CurrentWindow() const
+{
+    StallBreakdown window = m_current;
+    window.pipe_fill = m_fill_samples ? m_fill_sum / m_fill_samples : 0;
+
+    // A wait means the pipe was full. Whether FFmpeg progressed tells if it was busy encoding or stuck.
+    bool progressed = m_last_stats.frames != m_window_start_frames;
+    if (!progressed && QpcToMicroseconds(m_last_sample_qpc - m_window_start_qpc) < PROGRESS_INTERVAL_US)
+        progressed = m_last_stats.speed > 0;
+    if (progressed)
+        window.encoder_bound_s += m_window_wait_s;
+    else
+        window.pipe_blocked_s += m_window_wait_s;
+    return window;
+}
+
+void StallProfiler::Add(StallBreakdown& total, const StallBreakdown& window)
+{
+    // Fill is weighted by time, so short windows count less
+    total.pipe_fill = (total.pipe_fill * total.wall_s + window.pipe_fill * window.wall_s);
+    total.wall_s += window.wall_s;
+    total.pipe_fill = total.wall_s > 0 ? total.pipe_fill / total.wall_s : 0;
+
+    total.producer_idle_s += window.producer_idle_s;
+    total.encoder_bound_s += window.encoder_bound_s;
+    total.pipe_blocked_s += window.pipe_blocked_s;
+    total.write_overhead_s += window.write_overhead_s;
+    total.encoder_speed = window.encoder_speed;
+}
+
+StallBreakdown StallProfiler::GetBreakdown() const
+{
+    StallBreakdown total;
+    for (const StallBreakdown& window : m_windows)
+        Add(total, window);
+
+    StallBreakdown current = CurrentWindow();
+    if (current.wall_s > 0)
+        Add(total, current);
+    return total;
+}
+
+StallBreakdown StallProfiler::GetLastWindow() const {
+    return m_windows.empty() ? StallBreakdown() : m_windows.back();
+}
+
+}
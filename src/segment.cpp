@@ -0,0 +1,342 @@
+#include <ffmpipe/segment.h>
+#include "clock.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace ffmpipe
+{
+
+bool ConcatSegments(
+    const std::filesystem::path& ffmpeg_path, const std::vector<std::filesystem::path>& segments,
+    const std::filesystem::path& output_path, const std::filesystem::path& list_path,
+    Pipe::PrintFunc print_fn
+) {
+    {
+        std::ofstream list(list_path, std::ios::binary | std::ios::trunc);
+        for (const std::filesystem::path& segment : segments)
+        {
+            // FFmpeg resolves relative entries against the list's directory, not the working directory
+            std::error_code error;
+            const std::filesystem::path absolute = std::filesystem::absolute(segment, error);
+            // Single quotes are escaped by closing the string, then adding an escaped quote
+            list << "file '";
+            for (char ch : (error ? segment : absolute).u8string())
+            {
+                if (ch == '\'')
+                    list << "'\\''";
+                else
+                    list << ch;
+            }
+            list << "'\n";
+        }
+        if (!list)
+            return false;
+    }
+
+    std::wstringstream args;
+    args << L"-y -f concat -safe 0 -i " << QuoteArg(list_path.wstring()) << L" -c copy " << QuoteArg(output_path.wstring());
+
+    PipePtr pipe = Pipe::Create(ffmpeg_path, args.str());
+    if (!pipe)
+        return false;
+    pipe->SetPrintFunc(print_fn);
+    pipe->Close();
+    
+    bool ok = pipe->GetExitCode() == 0;
+    std::error_code error;
+    std::filesystem::remove(list_path, error);
+    return ok;
+}
+
+ResumableEncoder::ResumableEncoder(ResumableEncodeOptions options)
+    : m_options(std::move(options))
+{
+    m_segment_dir = m_options.output_path;
+    m_segment_dir += ".segments";
+    LoadJournal();
+}
+
+std::filesystem::path ResumableEncoder::SegmentPath(uint64_t segment) const
+{
+    std::stringstream name;
+    name << "segment_" << std::setw(6) << std::setfill('0') << segment;
+    std::filesystem::path path = m_segment_dir / name.str();
+    path += m_options.output_path.extension();
+    return path;
+}
+
+std::filesystem::path ResumableEncoder::JournalPath() const {
+    return m_segment_dir / "journal.txt";
+}
+
+void ResumableEncoder::LoadJournal()
+{
+    m_completed_segments = 0;
+
+    std::ifstream journal(JournalPath());
+    std::string key;
+    uint64_t frames_per_segment = 0, completed_segments = 0;
+    while (journal >> key)
+    {
+        if (key == "frames_per_segment")
+            journal >> frames_per_segment;
+        else if (key == "completed_segments")
+            journal >> completed_segments;
+    }
+
+    // A journal from different options can't be resumed
+    if (frames_per_segment == m_options.frames_per_segment)
+        m_completed_segments = completed_segments;
+}
+
+bool ResumableEncoder::SaveJournal(uint64_t last_frame)
+{
+    std::filesystem::path temp_path = JournalPath();
+    temp_path += ".tmp";
+    {
+        std::ofstream journal(temp_path, std::ios::trunc);
+        journal << "frames_per_segment " << m_options.frames_per_segment << '\n';
+        journal << "completed_segments " << m_completed_segments << '\n';
+        journal << "last_frame " << last_frame << '\n';
+        if (!journal.flush())
+            return false;
+    }
+    // Replace the journal atomically, so a crash leaves either the old or the new one
+    return MoveFileExW(temp_path.wstring().c_str(), JournalPath().wstring().c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+bool ResumableEncoder::EncodeSegment(uint64_t segment, uint64_t first_frame, uint64_t num_frames, const FrameSource& source, uint8_t* buffer)
+{
+    std::wstringstream args;
+    args << L"-y " << m_options.input_args << L" -i - " << m_options.output_args << L' ' << QuoteArg(SegmentPath(segment).wstring());
+
+    // The file may be a link to a cached segment, which FFmpeg would overwrite in place
+    std::error_code error;
+    std::filesystem::remove(SegmentPath(segment), error);
+
+    PipePtr pipe = Pipe::Create(m_options.ffmpeg_path, args.str(), m_options.pipe_options);
+    if (!pipe)
+        return false;
+    pipe->SetPrintFunc(m_print_fn);
+
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        if (!source(first_frame + i, buffer) || !pipe->Write(buffer, m_options.frame_size))
+        {
+            pipe->Close(m_options.pipe_options.timeout_ms);
+            return false;
+        }
+    }
+
+    pipe->Close();
+    return pipe->GetExitCode() == 0;
+}
+
+bool ResumableEncoder::EncodeCachedSegment(uint64_t segment, uint64_t first_frame, uint64_t num_frames, const FrameSource& source, uint8_t* buffer)
+{
+    std::wstringstream args;
+    // A different FFmpeg build may encode the same arguments differently
+    args << ExecutableIdentity(m_options.ffmpeg_path) << L'\n';
+    args << m_options.input_args << L'\n' << m_options.output_args << L'\n';
+    args << m_options.output_path.extension().wstring() << L'\n' << m_options.frame_size;
+
+    SegmentKey key(args.str());
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        if (!source(first_frame + i, buffer))
+            return false;
+        key.AddFrame(buffer, m_options.frame_size);
+    }
+
+    if (m_options.cache->Fetch(key, SegmentPath(segment)))
+        return true;
+    if (!EncodeSegment(segment, first_frame, num_frames, source, buffer))
+        return false;
+    // A full or unwritable cache doesn't fail the encode
+    m_options.cache->Store(key, SegmentPath(segment));
+    return true;
+}
+
+bool ResumableEncoder::Run(uint64_t total_frames, const FrameSource& source)
+{
+    const uint64_t frames_per_segment = m_options.frames_per_segment;
+    if (frames_per_segment == 0)
+        return false;
+    
+    std::error_code error;
+    std::filesystem::create_directories(m_segment_dir, error);
+    if (error)
+        return false;
+
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[m_options.frame_size]);
+    const uint64_t num_segments = (total_frames + frames_per_segment - 1) / frames_per_segment;
+
+    while (m_completed_segments < num_segments)
+    {
+        uint64_t first_frame = m_completed_segments * frames_per_segment;
+        uint64_t num_frames = total_frames - first_frame;
+        if (num_frames > frames_per_segment)
+            num_frames = frames_per_segment;
+
+        bool ok = m_options.cache
+            ? EncodeCachedSegment(m_completed_segments, first_frame, num_frames, source, buffer.get())
+            : EncodeSegment(m_completed_segments, first_frame, num_frames, source, buffer.get());
+        if (!ok)
+            return false;
+        
+        ++m_completed_segments;
+        if (!SaveJournal(first_frame + num_frames - 1))
+            return false;
+    }
+
+    std::vector<std::filesystem::path> segments;
+    for (uint64_t i = 0; i < num_segments; ++i)
+        segments.push_back(SegmentPath(i));
+    
+    if (!ConcatSegments(m_options.ffmpeg_path, segments, m_options.output_path, m_segment_dir / "concat.txt", m_print_fn))
+        return false;
+    
+    std::filesystem::remove_all(m_segment_dir, error);
+    m_completed_segments = 0;
+    return true;
+}
+
+ClipBatch::ClipBatch(ClipBatchOptions options)
+    : m_options(std::move(options))
+{}
+
+std::filesystem::path ClipBatch::ClipPath(uint64_t clip) const
+{
+    std::wstringstream name;
+    name << L"clip_" << std::setw(6) << std::setfill(L'0') << clip << m_options.output_extension;
+    return m_options.output_dir / name.str();
+}
+
+void ClipBatch::PollList(const std::filesystem::path& list_path)
+{
+    std::ifstream list(list_path, std::ios::binary);
+    if (!list.seekg(m_list_offset))
+        return;
+
+    // FFmpeg appends a line per finalized file. A line without its newline is still being written.
+    std::string line;
+    while (std::getline(list, line) && !list.eof())
+    {
+        m_list_offset += line.size() + 1;
+        if (m_clip_fn)
+            m_clip_fn(m_next_clip, ClipPath(m_next_clip));
+        ++m_next_clip;
+    }
+}
+
+bool ClipBatch::EncodeRun(
+    uint64_t first_clip, uint64_t end_clip, const std::vector<uint64_t>& clip_frames,
+    const ClipFrameSource& source, uint8_t* buffer
+) {
+    // Split before the first frame of each later clip, and force a keyframe there so the split can happen.
+    // Keyframe times are half a frame early, so rounding can't move them onto the next frame.
+    std::wstringstream split_frames, key_times;
+    key_times << std::fixed << std::setprecision(6);
+    uint64_t frame = 0;
+    for (uint64_t clip = first_clip; clip < end_clip; ++clip)
+    {
+        if (clip > first_clip)
+        {
+            const wchar_t* separator = clip > first_clip + 1 ? L"," : L"";
+            split_frames << separator << frame;
+            key_times << separator << (frame - 0.5) / m_options.framerate;
+        }
+        frame += clip_frames[clip];
+    }
+
+    const std::filesystem::path list_path = m_options.output_dir / ("clips_" + std::to_string(first_clip) + ".txt");
+    std::filesystem::path pattern = m_options.output_dir / L"clip_%06d";
+    pattern += m_options.output_extension;
+
+    std::wstringstream args;
+    args << L"-y " << m_options.input_args << L" -i - " << m_options.output_args;
+    if (end_clip - first_clip > 1)
+        args << L" -force_key_frames " << key_times.str() << L" -segment_frames " << split_frames.str();
+    args << L" -f segment -segment_start_number " << first_clip << L" -reset_timestamps 1";
+    args << L" -segment_list " << QuoteArg(list_path.wstring()) << L" -segment_list_type flat ";
+    args << QuoteArg(pattern.wstring());
+
+    std::error_code error;
+    std::filesystem::remove(list_path, error);
+    m_next_clip = first_clip;
+    m_list_offset = 0;
+
+    PipePtr pipe = Pipe::Create(m_options.ffmpeg_path, args.str(), m_options.pipe_options);
+    if (!pipe)
+        return false;
+    pipe->SetPrintFunc(m_print_fn);
+    ++m_process_count;
+
+    // Opening the list costs a few microseconds, so it is polled a few times per second rather than per frame
+    const int64_t poll_us = 100'000;
+    int64_t last_poll_qpc = QpcNow();
+    for (uint64_t clip = first_clip; clip < end_clip; ++clip)
+    {
+        for (uint64_t i = 0; i < clip_frames[clip]; ++i)
+        {
+            if (!source(clip, i, buffer) || !pipe->Write(buffer, m_options.frame_size))
+            {
+                pipe->Close(m_options.pipe_options.timeout_ms);
+                PollList(list_path);
+                return false;
+            }
+        }
+        if (QpcToMicroseconds(QpcNow() - last_poll_qpc) >= poll_us)
+        {
+            PollList(list_path);
+            last_poll_qpc = QpcNow();
+        }
+    }
+
+    pipe->Close();
+    PollList(list_path);
+    std::filesystem::remove(list_path, error);
+    return pipe->GetExitCode() == 0 && m_next_clip == end_clip;
+}
+
+bool ClipBatch::Run(const std::vector<uint64_t>& clip_frames, const ClipFrameSource& source)
+{
+    m_process_count = 0;
+    if (m_options.framerate <= 0 || std::find(clip_frames.begin(), clip_frames.end(), 0) != clip_frames.end())
+        return false;
+
+    std::error_code error;
+    std::filesystem::create_directories(m_options.output_dir, error);
+    if (error)
+        return false;
+
+    // Windows limits a command line to 32767 characters. Leave room for the rest of the arguments.
+    const size_t max_boundary_chars = 24'000;
+
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[m_options.frame_size]);
+    uint64_t first_clip = 0;
+    while (first_clip < clip_frames.size())
+    {
+        // Each boundary adds a frame number and a time, such as `,3600,59.991667`
+        size_t chars = 0;
+        uint64_t end_clip = first_clip + 1;
+        uint64_t frame = clip_frames[first_clip];
+        while (end_clip < clip_frames.size())
+        {
+            chars += std::to_string(frame).size() * 2 + 10;
+            if (chars > max_boundary_chars)
+                break;
+            frame += clip_frames[end_clip];
+            ++end_clip;
+        }
+
+        if (!EncodeRun(first_clip, end_clip, clip_frames, source, buffer.get()))
+            return false;
+        first_clip = end_clip;
+    }
+    return true;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include <ffmpipe/segment_cache.h>
+#include <ffmpipe/frame.h>
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+
+namespace ffmpipe
+{
+
+/// @brief Seed of the second hash chain. Any constant works, as long as it differs from the first chain's 0.
+static const uint64_t SEGMENT_KEY_SEED = 0x9E3779B97F4A7C15ull;
+static const size_t SEGMENT_KEY_DIGITS = 32;
+
+SegmentKey::SegmentKey(std::wstring_view encode_args)
+{
+    hash[0] = HashBytes(encode_args.data(), encode_args.size() * sizeof(wchar_t), 0);
+    hash[1] = HashBytes(encode_args.data(), encode_args.size() * sizeof(wchar_t), SEGMENT_KEY_SEED);
+}
+
+void SegmentKey::AddFrame(const void* frame, size_t size)
+{
+    hash[0] = HashBytes(frame, size, hash[0]);
+    hash[1] = HashBytes(frame, size, hash[1]);
+}
+
+std::string SegmentKey::ToString() const
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string text(SEGMENT_KEY_DIGITS, '0');
+    for (size_t i = 0; i < SEGMENT_KEY_DIGITS; ++i)
+        text[i] = digits[(hash[i / 16] >> (60 - i % 16 * 4)) & 0xF];
+    return text;
+}
+
+/// @brief Whether a file in the cache directory is a segment, rather than a staged one or something unrelated
+static bool IsSegmentName(const std::string& name)
+{
+    if (name.size() <= SEGMENT_KEY_DIGITS || name[SEGMENT_KEY_DIGITS] != '.')
+        return false;
+    for (size_t i = 0; i < SEGMENT_KEY_DIGITS; ++i)
+    {
+        if (!isxdigit((unsigned char)name[i]))
+            return false;
+    }
+    return name.compare(name.size() - 4, 4, ".tmp") != 0;
+}
+
+/// @brief Make `to` refer to the contents of `from`, by a hard link if possible, or else by a copy
+static bool LinkOrCopy(const std::filesystem::path& from, const std::filesystem::path& to)
+{
+    std::error_code error;
+    std::filesystem::remove(to, error);
+    if (CreateHardLinkW(to.wstring().c_str(), from.wstring().c_str(), nullptr))
+        return true;
+    // Links fail across volumes and on file systems without them
+    return std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, error);
+}
+
+/// @brief Mark a segment as just used, for the order of later processes
+static void Touch(const std::filesystem::path& path)
+{
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+}
+
+SegmentCache::SegmentCache(std::filesystem::path dir, uint64_t max_bytes)
+    : m_dir(std::move(dir)), m_max_bytes(max_bytes)
+{
+    std::error_code error;
+    std::filesystem::create_directories(m_dir, error);
+
+    struct Found
+    {
+        std::filesystem::file_time_type time;
+        std::string name;
+        uint64_t bytes;
+    };
+    std::vector<Found> found;
+    for (std::filesystem::directory_iterator it(m_dir, error), end; !error && it != end; it.increment(error))
+    {
+        if (!it->is_regular_file(error))
+            continue;
+        const std::string name = it->path().filename().string();
+        if (IsSegmentName(name))
+            found.push_back({ it->last_write_time(error), name, it->file_size(error) });
+        else if (it->path().extension() == ".tmp")
+        {
+            // Left by a process that stopped while staging a segment
+            std::error_code remove_error;
+            std::filesystem::remove(it->path(), remove_error);
+        }
+    }
+
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.time > b.time; });
+    for (const Found& segment : found)
+    {
+        m_lru.push_back(segment.name);
+        m_cache[segment.name] = CacheEntry { segment.bytes, std::prev(m_lru.end()) };
+        m_bytes += segment.bytes;
+    }
+    Evict();
+}
+
+bool SegmentCache::Fetch(const SegmentKey& key, const std::filesystem::path& path)
+{
+    const std::string name = key.ToString() + path.extension().string();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto cached = m_cache.find(name);
+    if (cached != m_cache.end())
+    {
+        if (LinkOrCopy(m_dir / name, path))
+        {
+            ++m_hits;
+            m_lru.splice(m_lru.begin(), m_lru, cached->second.lru_it);
+            Touch(m_dir / name);
+            return true;
+        }
+        // Deleted by another process sharing the directory
+        m_bytes -= cached->second.bytes;
+        m_lru.erase(cached->second.lru_it);
+        m_cache.erase(cached);
+    }
+    ++m_misses;
+    return false;
+}
+
+bool SegmentCache::Store(const SegmentKey& key, const std::filesystem::path& path)
+{
+    std::error_code error;
+    const uint64_t bytes = std::filesystem::file_size(path, error);
+    if (error || bytes > m_max_bytes)
+        return false;
+
+    // Stage under a temporary name, so other processes never see a partial segment
+    const std::string name = key.ToString() + path.extension().string();
+    const std::filesystem::path entry_path = m_dir / name;
+    std::filesystem::path temp_path = entry_path;
+    temp_path += "." + std::to_string(GetCurrentThreadId()) + ".tmp";
+    if (!LinkOrCopy(path, temp_path))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!MoveFileExW(temp_path.wstring().c_str(), entry_path.wstring().c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    auto cached = m_cache.find(name);
+    if (cached != m_cache.end())
+    {
+        m_bytes -= cached->second.bytes;
+        m_lru.erase(cached->second.lru_it);
+        m_cache.erase(cached);
+    }
+    m_lru.push_front(name);
+    m_cache[name] = CacheEntry { bytes, m_lru.begin() };
+    m_bytes += bytes;
+    Evict();
+    return true;
+}
+
+void SegmentCache::Evict()
+{
+    while (m_bytes > m_max_bytes && !m_lru.empty())
+    {
+        // Jobs hold their own links to fetched segments, so removing the cache's link is safe
+        std::error_code error;
+        std::filesystem::remove(m_dir / m_lru.back(), error);
+        auto it = m_cache.find(m_lru.back());
+        m_bytes -= it->second.bytes;
+        m_cache.erase(it);
+        m_lru.pop_back();
+        ++m_evictions;
+    }
+}
+
+void SegmentCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const std::string& name : m_lru)
+    {
+        std::error_code error;
+        std::filesystem::remove(m_dir / name, error);
+    }
+    m_lru.clear();
+    m_cache.clear();
+    m_bytes = 0;
+}
+
+SegmentCacheStats SegmentCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    SegmentCacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    stats.entries = m_cache.size();
+    stats.bytes = m_bytes;
+    stats.max_bytes = m_max_bytes;
+    return stats;
+}
+
+}
\ No newline at end of file
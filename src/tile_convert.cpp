@@ -0,0 +1,175 @@
+#include <ffmpipe/tile_convert.h>
+#include <ffmpipe/worker_pool.h>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define FFMPIPE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace ffmpipe
+{
+
+static bool BytesEqual(const uint8_t* a, const uint8_t* b, size_t size)
+{
+    size_t i = 0;
+#ifdef FFMPIPE_SSE2
+    for (; i + 64 <= size; i += 64)
+    {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)), _mm_loadu_si128((const __m128i*)(b + i + 16)));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 32)), _mm_loadu_si128((const __m128i*)(b + i + 32)));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 48)), _mm_loadu_si128((const __m128i*)(b + i + 48)));
+        __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            return false;
+    }
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            return false;
+    }
+#endif
+    return memcmp(a + i, b + i, size - i) == 0;
+}
+
+TileConverter::TileConverter(uint32_t width, uint32_t height, PixelFormat src_format, uint32_t tile_size)
+    : m_width(width), m_height(height), m_tile_size(tile_size ? (tile_size + 15) / 16 * 16 : 64),
+    m_format(src_format), m_bytes_per_pixel(BytesPerPixel(src_format)),
+    m_tiles_x((width + m_tile_size - 1) / m_tile_size), m_tiles_y((height + m_tile_size - 1) / m_tile_size)
+{
+    m_previous.resize(FrameSize(src_format, width, height));
+    m_output.resize(FrameSize(PixelFormat::I420, width, height));
+    m_tile_marks.resize((size_t)m_tiles_x * m_tiles_y);
+}
+
+void TileConverter::ConvertAll(const uint8_t* src)
+{
+    ConvertToI420(src, m_format, m_width, m_height, m_output.data(), m_pool);
+    // Not StreamCopy, since the next frame is compared against this copy and it should stay in cache
+    memcpy(m_previous.data(), src, m_previous.size());
+    m_has_previous = true;
+    m_dirty_tiles = GetTileCount();
+}
+
+void TileConverter::ConvertTile(const uint8_t* src, uint32_t tile_x, uint32_t tile_y)
+{
+    FrameRect rect;
+    rect.x = tile_x * m_tile_size;
+    rect.y = tile_y * m_tile_size;
+    rect.width = m_tile_size;
+    rect.height = m_tile_size;
+    ConvertToI420Rect(src, m_format, m_width, m_height, rect, m_output.data());
+
+    const size_t stride = (size_t)m_width * m_bytes_per_pixel;
+    const uint32_t x1 = rect.x + m_tile_size < m_width ? rect.x + m_tile_size : m_width;
+    const uint32_t y1 = rect.y + m_tile_size < m_height ? rect.y + m_tile_size : m_height;
+    const size_t row_bytes = (size_t)(x1 - rect.x) * m_bytes_per_pixel;
+    for (uint32_t y = rect.y; y < y1; ++y)
+    {
+        const size_t offset = y * stride + (size_t)rect.x * m_bytes_per_pixel;
+        memcpy(m_previous.data() + offset, src + offset, row_bytes);
+    }
+}
+
+void TileConverter::ForEachTileRow(const std::function<size_t(uint32_t tile_y)>& fn)
+{
+    // Tiles are a multiple of 16 rows, so rows of tiles never share a chroma row
+    if (!m_pool)
+    {
+        m_dirty_tiles = 0;
+        for (uint32_t tile_y = 0; tile_y < m_tiles_y; ++tile_y)
+            m_dirty_tiles += fn(tile_y);
+        return;
+    }
+    std::atomic<size_t> dirty_tiles = 0;
+    m_pool->ForEachBand(m_tiles_y, 1, [&](uint32_t first_row, uint32_t end_row) {
+        size_t dirty = 0;
+        for (uint32_t tile_y = first_row; tile_y < end_row; ++tile_y)
+            dirty += fn(tile_y);
+        dirty_tiles += dirty;
+    });
+    m_dirty_tiles = dirty_tiles;
+}
+
+const uint8_t* TileConverter::Convert(const void* src)
+{
+    const uint8_t* frame = (const uint8_t*)src;
+    if (!m_bytes_per_pixel)
+        return m_output.data();
+    if (!m_has_previous)
+    {
+        ConvertAll(frame);
+        return m_output.data();
+    }
+
+    const size_t stride = (size_t)m_width * m_bytes_per_pixel;
+    ForEachTileRow([&](uint32_t tile_y) {
+        size_t dirty = 0;
+        const uint32_t y0 = tile_y * m_tile_size;
+        const uint32_t y1 = y0 + m_tile_size < m_height ? y0 + m_tile_size : m_height;
+        for (uint32_t tile_x = 0; tile_x < m_tiles_x; ++tile_x)
+        {
+            const uint32_t x0 = tile_x * m_tile_size;
+            const uint32_t x1 = x0 + m_tile_size < m_width ? x0 + m_tile_size : m_width;
+            const size_t row_bytes = (size_t)(x1 - x0) * m_bytes_per_pixel;
+
+            for (uint32_t y = y0; y < y1; ++y)
+            {
+                const size_t offset = y * stride + (size_t)x0 * m_bytes_per_pixel;
+                if (!BytesEqual(frame + offset, m_previous.data() + offset, row_bytes))
+                {
+                    ConvertTile(frame, tile_x, tile_y);
+                    ++dirty;
+                    break;
+                }
+            }
+        }
+        return dirty;
+    });
+    return m_output.data();
+}
+
+const uint8_t* TileConverter::Convert(const void* src, const FrameRect* dirty_rects, size_t rect_count)
+{
+    const uint8_t* frame = (const uint8_t*)src;
+    if (!m_bytes_per_pixel)
+        return m_output.data();
+    if (!m_has_previous)
+    {
+        ConvertAll(frame);
+        return m_output.data();
+    }
+
+    memset(m_tile_marks.data(), 0, m_tile_marks.size());
+    for (size_t i = 0; i < rect_count; ++i)
+    {
+        const FrameRect& rect = dirty_rects[i];
+        if (rect.x >= m_width || rect.y >= m_height || !rect.width || !rect.height)
+            continue;
+        const uint32_t x1 = rect.width > m_width - rect.x ? m_width : rect.x + rect.width;
+        const uint32_t y1 = rect.height > m_height - rect.y ? m_height : rect.y + rect.height;
+        for (uint32_t tile_y = rect.y / m_tile_size; tile_y <= (y1 - 1) / m_tile_size; ++tile_y)
+        {
+            for (uint32_t tile_x = rect.x / m_tile_size; tile_x <= (x1 - 1) / m_tile_size; ++tile_x)
+                m_tile_marks[(size_t)tile_y * m_tiles_x + tile_x] = 1;
+        }
+    }
+
+    ForEachTileRow([&](uint32_t tile_y) {
+        size_t dirty = 0;
+        for (uint32_t tile_x = 0; tile_x < m_tiles_x; ++tile_x)
+        {
+            if (m_tile_marks[(size_t)tile_y * m_tiles_x + tile_x])
+            {
+                ConvertTile(frame, tile_x, tile_y);
+                ++dirty;
+            }
+        }
+        return dirty;
+    });
+    return m_output.data();
+}
+
+}
\ No newline at end of file
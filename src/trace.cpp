@@ -0,0 +1,18 @@
+#include "trace.h"
+
+#ifdef FFMPIPE_TRACING
+
+// {64235bdb-d78e-5589-fa59-6add179ab7bf}, derived from the name like an EventSource GUID, so tools accept "*ffmpipe"
+TRACELOGGING_DEFINE_PROVIDER(
+    g_ffmpipe_provider, "ffmpipe",
+    (0x64235bdb, 0xd78e, 0x5589, 0xfa, 0x59, 0x6a, 0xdd, 0x17, 0x9a, 0xb7, 0xbf)
+);
+
+/// @brief Registers the provider for the lifetime of the program
+static struct ProviderRegistration
+{
+    ProviderRegistration() { TraceLoggingRegister(g_ffmpipe_provider); }
+    ~ProviderRegistration() { TraceLoggingUnregister(g_ffmpipe_provider); }
+} s_registration;
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+/**
+ * ETW TraceLogging events for profiling, enabled by the FFMPIPE_TRACING definition.
+ * 
+ * Events cost one branch when no trace session is listening, and their fields are only evaluated while one is.
+ * The provider is named "ffmpipe", with the name-derived GUID {64235bdb-d78e-5589-fa59-6add179ab7bf}.
+ * See tools/ffmpipe.wprp to record them.
+ */
+
+#ifdef FFMPIPE_TRACING
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(g_ffmpipe_provider);
+
+/// @brief Write an event, such as `FFMPIPE_TRACE("WriteStart", TraceLoggingUInt64(id, "pipe"))`
+#define FFMPIPE_TRACE(name, ...) TraceLoggingWrite(g_ffmpipe_provider, name, __VA_ARGS__)
+#else
+#define FFMPIPE_TRACE(name, ...) ((void)0)
+#endif
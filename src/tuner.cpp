@@ -0,0 +1,242 @@
+#include <ffmpipe/tuner.h>
+#include <ffmpipe/frame.h>
+#include "clock.h"
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace ffmpipe
+{
+
+Tuner::Tuner(TunerOptions options)
+    : m_options(std::move(options))
+{}
+
+double Tuner::MeasureSsim(const std::filesystem::path& encoded, const FrameSource& source, uint8_t* buffer)
+{
+    // The encode is input 0 and the source is input 1. The filter needs both at the same size.
+    std::wstringstream args;
+    args << L"-i " << QuoteArg(encoded.wstring()) << L' ' << m_options.input_args << L" -i - ";
+    args << L"-lavfi [0:v][1:v]ssim -f null -";
+
+    PipePtr pipe = Pipe::Create(m_options.ffmpeg_path, args.str(), m_options.pipe_options);
+    if (!pipe)
+        return -1;
+    std::string output;
+    pipe->SetPrintFunc([&](std::string_view text) { output += text; });
+
+    for (uint64_t i = 0; i < m_options.frame_count; ++i)
+    {
+        if (!source(i, buffer) || !pipe->Write(buffer, m_options.frame_size))
+        {
+            pipe->Close(m_options.pipe_options.timeout_ms);
+            return -1;
+        }
+    }
+    pipe->Close();
+    if (pipe->GetExitCode() != 0)
+        return -1;
+
+    // The summary line looks like: SSIM Y:0.987 (18.9) U:0.991 (20.5) V:0.990 (20.1) All:0.988 (19.3)
+    size_t all = output.rfind("All:");
+    if (all == std::string::npos)
+        return -1;
+    return atof(output.c_str() + all + 4);
+}
+
+TrialResult Tuner::RunTrial(const std::wstring& output_args, uint64_t trial, const FrameSource& source)
+{
+    TrialResult result;
+    result.output_args = output_args;
+
+    // Keep the container neutral, so any video codec fits
+    const std::filesystem::path output_path = m_options.work_dir / ("trial-" + std::to_string(trial) + ".mkv");
+    std::wstringstream args;
+    args << L"-y " << m_options.input_args << L" -i - " << output_args << L' ' << QuoteArg(output_path.wstring());
+
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[m_options.frame_size]);
+    const int64_t start_qpc = QpcNow();
+    // A failed trial leaves a partial file, which must not pile up in the work directory
+    std::error_code error;
+    PipePtr pipe = Pipe::Create(m_options.ffmpeg_path, args.str(), m_options.pipe_options);
+    if (!pipe)
+    {
+        std::filesystem::remove(output_path, error);
+        return result;
+    }
+    pipe->SetPrintFunc(m_print_fn);
+
+    for (uint64_t i = 0; i < m_options.frame_count; ++i)
+    {
+        if (!source(i, buffer.get()) || !pipe->Write(buffer.get(), m_options.frame_size))
+        {
+            pipe->Close(m_options.pipe_options.timeout_ms);
+            std::filesystem::remove(output_path, error);
+            return result;
+        }
+    }
+    pipe->Close();
+    const double seconds = QpcToMicroseconds(QpcNow() - start_qpc) / 1e6;
+
+    result.output_bytes = std::filesystem::file_size(output_path, error);
+    if (pipe->GetExitCode() == 0 && !error)
+    {
+        result.ok = true;
+        result.fps = seconds > 0 ? m_options.frame_count / seconds : 0;
+        result.cpu_seconds = pipe->GetProcessUsage().cpu_seconds;
+        if (m_options.frame_count)
+            result.bitrate_kbps = result.output_bytes * 8 / 1000.0 * m_options.framerate / m_options.frame_count;
+        if (m_options.measure_quality)
+            result.ssim = MeasureSsim(output_path, source, buffer.get());
+    }
+    std::filesystem::remove(output_path, error);
+    return result;
+}
+
+std::vector<TrialResult> Tuner::Run(
+    std::string_view content_class, const std::vector<std::wstring>& candidates, const FrameSource& source
+) {
+    std::vector<TrialResult> results(candidates.size());
+    std::vector<size_t> pending;
+    const std::string setup = SetupKey();
+    {
+        std::lock_guard<std::mutex> lock(m_cache_mutex);
+        LoadCache();
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            auto cached = std::find_if(m_cache.begin(), m_cache.end(), [&](const CacheEntry& entry) {
+                return entry.content_class == content_class && entry.setup == setup && entry.result.output_args == candidates[i]
+                    && (entry.result.ssim >= 0 || !m_options.measure_quality);
+            });
+            if (cached != m_cache.end())
+            {
+                results[i] = cached->result;
+                results[i].cached = true;
+            }
+            else
+                pending.push_back(i);
+        }
+    }
+    if (pending.empty())
+        return results;
+
+    std::error_code error;
+    std::filesystem::create_directories(m_options.work_dir, error);
+
+    // Workers take the next pending candidate until none are left
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+        for (size_t job = next++; job < pending.size(); job = next++)
+            results[pending[job]] = RunTrial(candidates[pending[job]], pending[job], source);
+    };
+    const size_t thread_count = std::clamp<size_t>(m_options.max_concurrent, 1, pending.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; ++i)
+        threads.emplace_back(worker);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(m_cache_mutex);
+    for (size_t index : pending)
+    {
+        if (!results[index].ok)
+            continue;
+        auto existing = std::find_if(m_cache.begin(), m_cache.end(), [&](const CacheEntry& entry) {
+            return entry.content_class == content_class && entry.setup == setup && entry.result.output_args == candidates[index];
+        });
+        if (existing != m_cache.end())
+            existing->result = results[index];
+        else
+            m_cache.push_back({ std::string(content_class), setup, results[index] });
+    }
+    SaveCache();
+    return results;
+}
+
+std::vector<TrialResult> Tuner::ParetoSet(const std::vector<TrialResult>& results)
+{
+    auto dominates = [](const TrialResult& a, const TrialResult& b) {
+        const bool quality = a.ssim >= 0 && b.ssim >= 0;
+        const bool no_worse = a.fps >= b.fps && a.output_bytes <= b.output_bytes && (!quality || a.ssim >= b.ssim);
+        const bool better = a.fps > b.fps || a.output_bytes < b.output_bytes || (quality && a.ssim > b.ssim);
+        return no_worse && better;
+    };
+
+    std::vector<TrialResult> pareto;
+    for (const TrialResult& candidate : results)
+    {
+        if (!candidate.ok)
+            continue;
+        bool dominated = std::any_of(results.begin(), results.end(), [&](const TrialResult& other) {
+            return other.ok && dominates(other, candidate);
+        });
+        if (!dominated)
+            pareto.push_back(candidate);
+    }
+    std::sort(pareto.begin(), pareto.end(), [](const TrialResult& a, const TrialResult& b) { return a.fps > b.fps; });
+    return pareto;
+}
+
+std::string Tuner::SetupKey() const
+{
+    // The same content and arguments encode differently with another FFmpeg build or another clip
+    std::wstringstream setup;
+    setup << ExecutableIdentity(m_options.ffmpeg_path) << L'\n' << m_options.input_args << L'\n';
+    setup << m_options.frame_size << L'\n' << m_options.frame_count;
+    const std::wstring text = setup.str();
+
+    std::stringstream key;
+    key << std::hex << std::setw(16) << std::setfill('0') << HashBytes(text.data(), text.size() * sizeof(wchar_t));
+    return key.str();
+}
+
+void Tuner::LoadCache()
+{
+    if (m_cache_loaded || m_options.cache_path.empty())
+        return;
+    m_cache_loaded = true;
+
+    // One result per line: class, tab, setup key, tab, args, tab, then fps, cpu_seconds, output_bytes, bitrate_kbps and ssim.
+    // Lines in the older format without a setup key fail to parse, so they are dropped.
+    std::ifstream file(m_options.cache_path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::stringstream fields(line);
+        std::string content_class, setup, args;
+        TrialResult result;
+        if (!std::getline(fields, content_class, '\t') || !std::getline(fields, setup, '\t') || !std::getline(fields, args, '\t'))
+            continue;
+        if (!(fields >> result.fps >> result.cpu_seconds >> result.output_bytes >> result.bitrate_kbps >> result.ssim))
+            continue;
+        result.output_args = std::filesystem::u8path(args).wstring();
+        result.ok = true;
+        m_cache.push_back({ std::move(content_class), std::move(setup), std::move(result) });
+    }
+}
+
+bool Tuner::SaveCache()
+{
+    if (m_options.cache_path.empty())
+        return true;
+
+    std::filesystem::path temp_path = m_options.cache_path;
+    temp_path += ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        for (const auto& [content_class, setup, result] : m_cache)
+        {
+            file << content_class << '\t' << setup << '\t' << std::filesystem::path(result.output_args).u8string() << '\t';
+            file << result.fps << ' ' << result.cpu_seconds << ' ' << result.output_bytes << ' ';
+            file << result.bitrate_kbps << ' ' << result.ssim << '\n';
+        }
+        if (!file.flush())
+            return false;
+    }
+    return MoveFileExW(temp_path.wstring().c_str(), m_options.cache_path.wstring().c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+}
\ No newline at end of file
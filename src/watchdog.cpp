@@ -0,0 +1,117 @@
+#include <ffmpipe/watchdog.h>
+#include <algorithm>
+
+namespace ffmpipe
+{
+
+/// @brief The watchdog thread only polls, so it needs a fraction of the default 1 MB stack
+static const SIZE_T WATCHDOG_STACK_SIZE = 64 * 1024;
+
+Watchdog::Watchdog(DWORD stall_ms, bool terminate, StallFunc on_stall)
+    : m_stall_ms(stall_ms), m_terminate(terminate), m_on_stall(std::move(on_stall))
+{
+    m_stop_event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (m_stop_event)
+        m_thread = CreateThread(nullptr, WATCHDOG_STACK_SIZE, ThreadProc, this, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+}
+
+Watchdog::~Watchdog()
+{
+    if (m_thread)
+    {
+        SetEvent(m_stop_event);
+        WaitForSingleObject(m_thread, INFINITE);
+        CloseHandle(m_thread);
+    }
+    if (m_stop_event)
+        CloseHandle(m_stop_event);
+}
+
+void Watchdog::Watch(const PipePtr& pipe)
+{
+    PipeStats stats = pipe->GetStats();
+    Entry entry;
+    entry.pipe = pipe;
+    entry.bytes_written = stats.bytes_written;
+    entry.frames = stats.frames;
+    entry.last_progress_ms = GetTickCount64();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.push_back(entry);
+}
+
+void Watchdog::Unwatch(const PipePtr& pipe)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.erase(
+        std::remove_if(m_entries.begin(), m_entries.end(), [&](const Entry& entry) {
+            return entry.pipe.lock() == pipe;
+        }),
+        m_entries.end()
+    );
+}
+
+DWORD WINAPI Watchdog::ThreadProc(LPVOID param)
+{
+    Watchdog* watchdog = (Watchdog*)param;
+    DWORD interval_ms = std::clamp<DWORD>(watchdog->m_stall_ms / 4, 10, 1000);
+
+    while (WaitForSingleObject(watchdog->m_stop_event, interval_ms) == WAIT_TIMEOUT)
+        watchdog->Check();
+    return 0;
+}
+
+void Watchdog::Check()
+{
+    std::vector<PipePtr> stalled;
+    // The watchdog may hold the last reference, and ~Pipe waits for FFmpeg, so pipes are released after the lock
+    std::vector<PipePtr> checked;
+    ULONGLONG now_ms = GetTickCount64();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            PipePtr pipe = it->pipe.lock();
+            if (!pipe)
+            {
+                it = m_entries.erase(it);
+                continue;
+            }
+            checked.push_back(pipe);
+
+            pipe->PollLatency();
+            PipeStats stats = pipe->GetStats();
+            // A hung FFmpeg may still take a few bytes at a time, so bytes only count as progress in bulk.
+            // Since the last progress, a healthy one has either reported a frame or read part of a buffer.
+            const uint64_t min_progress_bytes = stats.stdin_buffer_size / 4 ? stats.stdin_buffer_size / 4 : 1;
+            const bool progress = stats.frames != it->frames || stats.bytes_written - it->bytes_written >= min_progress_bytes;
+            // An idle producer is not a stall, so only time spent waiting on FFmpeg counts
+            if (!stats.busy || progress)
+            {
+                it->bytes_written = stats.bytes_written;
+                it->frames = stats.frames;
+                it->last_progress_ms = now_ms;
+                it->stalled = false;
+            }
+            else if (!it->stalled && now_ms - it->last_progress_ms >= m_stall_ms)
+            {
+                it->stalled = true;
+                stalled.push_back(pipe);
+            }
+            ++it;
+        }
+    }
+
+    // Call out without holding the lock, so callbacks may use Watch and Unwatch
+    for (const PipePtr& pipe : stalled)
+    {
+        ++m_stall_count;
+        if (m_on_stall)
+            m_on_stall(pipe);
+        if (m_terminate)
+            pipe->Terminate();
+    }
+}
+
+}
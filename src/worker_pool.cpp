@@ -0,0 +1,133 @@
+#include <ffmpipe/worker_pool.h>
+
+namespace ffmpipe
+{
+
+static const SIZE_T WORKER_STACK_SIZE = 64 * 1024;
+/// @brief Bands per thread, so threads that start late or run slower still share the work evenly
+static const uint32_t BANDS_PER_THREAD = 4;
+
+WorkerPool::WorkerPool(uint32_t thread_count, int numa_node)
+{
+    PROCESSOR_NUMBER processor = {0};
+    GetCurrentProcessorNumberEx(&processor);
+    if (numa_node < 0)
+    {
+        USHORT node = 0;
+        numa_node = GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+    }
+
+    // Only pin threads when there is more than one node. Otherwise the scheduler places them best.
+    GROUP_AFFINITY affinity = {0};
+    ULONG highest_node = 0;
+    bool pinned = GetNumaHighestNodeNumber(&highest_node) && highest_node > 0
+        && GetNumaNodeProcessorMaskEx((USHORT)numa_node, &affinity) && affinity.Mask;
+
+    if (thread_count == 0)
+    {
+        uint32_t processors = 0;
+        if (pinned)
+        {
+            for (KAFFINITY mask = affinity.Mask; mask; mask &= mask - 1)
+                ++processors;
+        }
+        else
+            processors = GetActiveProcessorCount(processor.Group);
+        thread_count = processors > 1 ? processors - 1 : 0;
+    }
+
+    m_wake_semaphore = CreateSemaphoreA(nullptr, 0, MAXLONG, nullptr);
+    m_done_event = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+    if (!m_wake_semaphore || !m_done_event)
+        return;
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+    {
+        HANDLE thread = CreateThread(nullptr, WORKER_STACK_SIZE, ThreadProc, this, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+        if (!thread)
+            break;
+        if (pinned)
+            SetThreadGroupAffinity(thread, &affinity, nullptr);
+        m_threads.push_back(thread);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    m_stop = true;
+    if (!m_threads.empty())
+        ReleaseSemaphore(m_wake_semaphore, (LONG)m_threads.size(), nullptr);
+    for (HANDLE thread : m_threads)
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    if (m_wake_semaphore)
+        CloseHandle(m_wake_semaphore);
+    if (m_done_event)
+        CloseHandle(m_done_event);
+}
+
+void WorkerPool::ForEachBand(uint32_t rows, uint32_t align, const BandFunc& fn)
+{
+    if (rows == 0)
+        return;
+    align = align ? align : 1;
+    const uint32_t units = (rows - 1) / align + 1;
+    const uint32_t max_bands = ((uint32_t)m_threads.size() + 1) * BANDS_PER_THREAD;
+    const uint32_t band_count = units < max_bands ? units : max_bands;
+    if (m_threads.empty() || band_count < 2)
+    {
+        fn(0, rows);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_job_mutex);
+    // The previous job is finished, so no thread reads these until the bands are published
+    m_fn = &fn;
+    m_rows = rows;
+    m_align = align;
+    m_units = units;
+    m_remaining.store(band_count, std::memory_order_relaxed);
+    m_bands.store((uint64_t)band_count << 32, std::memory_order_release);
+
+    const uint32_t wake = band_count - 1 < m_threads.size() ? band_count - 1 : (uint32_t)m_threads.size();
+    ReleaseSemaphore(m_wake_semaphore, (LONG)wake, nullptr);
+    Work();
+    // Set once per job, by whichever thread finished the last band
+    WaitForSingleObject(m_done_event, INFINITE);
+}
+
+void WorkerPool::Work()
+{
+    uint64_t bands = m_bands.load(std::memory_order_acquire);
+    for (;;)
+    {
+        const uint32_t band = (uint32_t)bands;
+        const uint32_t band_count = (uint32_t)(bands >> 32);
+        if (band >= band_count)
+            return;
+        // A thread woken late sees a finished job here, or fails the exchange if a new one started
+        if (!m_bands.compare_exchange_weak(bands, bands + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            continue;
+
+        // The job can't change until this band is done, so its fields are stable
+        const uint32_t first_row = (uint32_t)((uint64_t)band * m_units / band_count) * m_align;
+        const uint64_t end_row = (uint64_t)((band + 1) * (uint64_t)m_units / band_count) * m_align;
+        (*m_fn)(first_row, end_row < m_rows ? (uint32_t)end_row : m_rows);
+
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            SetEvent(m_done_event);
+        bands = m_bands.load(std::memory_order_acquire);
+    }
+}
+
+DWORD WINAPI WorkerPool::ThreadProc(LPVOID param)
+{
+    WorkerPool* pool = (WorkerPool*)param;
+    while (WaitForSingleObject(pool->m_wake_semaphore, INFINITE) == WAIT_OBJECT_0 && !pool->m_stop)
+        pool->Work();
+    return 0;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+# Prints power-of-two latency histograms from a trace recorded with ffmpipe.wprp.
+#   .\latency.ps1 ffmpipe.etl [-Field wait_us|write_us|close_us|spawn_us|first_output_us|...]
+# Startup fields: pipes_us and spawn_us are phases of Pipe::Create.
+# first_read_seen_us, first_output_us and first_progress_us count from the start of Create.
+param(
+    [Parameter(Mandatory = $true)][string]$Trace,
+    [string[]]$Field = @("wait_us", "write_us", "close_us", "pipes_us", "spawn_us", "first_read_seen_us", "first_output_us", "first_progress_us")
+)
+
+$xml = Join-Path $env:TEMP "ffmpipe-trace.xml"
+tracerpt $Trace -of XML -o $xml -y | Out-Null
+[xml]$events = Get-Content $xml
+
+$values = @{}
+foreach ($name in $Field) { $values[$name] = New-Object System.Collections.Generic.List[long] }
+foreach ($event in $events.Events.Event) {
+    foreach ($data in $event.EventData.Data) {
+        if ($values.ContainsKey($data.Name)) { $values[$data.Name].Add([long]$data.'#text') }
+    }
+}
+
+foreach ($name in $Field) {
+    $list = $values[$name]
+    if ($list.Count -eq 0) { continue }
+
+    # Bucket b holds [2^b, 2^(b+1)) microseconds, like bpftrace's hist()
+    $buckets = @{}
+    foreach ($v in $list) {
+        $b = if ($v -le 0) { 0 } else { [int][Math]::Floor([Math]::Log($v, 2)) }
+        $buckets[$b] = 1 + $buckets[$b]
+    }
+    $peak = ($buckets.Values | Measure-Object -Maximum).Maximum
+    "@$name ($($list.Count) samples, us):"
+    foreach ($b in ($buckets.Keys | Sort-Object)) {
+        $low = [long][Math]::Pow(2, $b)
+        $bar = "@" * [int][Math]::Ceiling(40 * $buckets[$b] / $peak)
+        "[{0,8}, {1,8}) {2,8} |{3,-40}|" -f $low, (2 * $low), $buckets[$b], $bar
+    }
+    ""
+}